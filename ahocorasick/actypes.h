@@ -82,6 +82,36 @@ typedef struct ac_pattid
     
 } AC_PATTID_t;
 
+/**
+ * Pattern flags
+ * 
+ * The flags restrict where a pattern is allowed to match. They can be 
+ * combined by bitwise OR and are set in the 'flags' field of the pattern, 
+ * which is only read by ac_trie_add_flags(); ac_trie_add() adds the pattern 
+ * with no flags, so the callers that predate the field are not affected. A 
+ * word consists of ASCII letters, digits, underscore and all the non-ASCII 
+ * bytes (so UTF-8 encoded words are not broken apart). The start and the end 
+ * of the input text count as both word and line boundaries. The same string 
+ * can be added more than once with different flags, e.g. as a whole word 
+ * with one replacement and anywhere with another; where several of them 
+ * match, the one added first is replaced.
+ */
+enum ac_pattflag
+{
+    AC_PATTFLAG_NONE = 0,
+    AC_PATTFLAG_WORD_START = 0x01,  /**< Not preceded by a word byte */
+    AC_PATTFLAG_WORD_END = 0x02,    /**< Not followed by a word byte */
+    AC_PATTFLAG_LINE_START = 0x04,  /**< Preceded by a new line */
+    AC_PATTFLAG_LINE_END = 0x08,    /**< Followed by a new line ('\n' or 
+                                     * '\r') */
+    AC_PATTFLAG_WHOLE_WORD = (AC_PATTFLAG_WORD_START|AC_PATTFLAG_WORD_END),
+    AC_PATTFLAG_NOCASE = 0x10,      /**< Ignore ASCII case; the trie must be 
+                                     * in AC_CASE_PER_PATTERN mode */
+    AC_PATTFLAG_MASK = 0x1f         /**< All the defined flags; any other 
+                                     * bit is rejected by 
+                                     * ac_trie_add_flags() */
+};
+
 /**
  * This is the pattern type that the trie must be fed by.
  */
@@ -90,6 +120,9 @@ typedef struct ac_pattern
     AC_TEXT_t ptext;    /**< The search string */
     AC_TEXT_t rtext;    /**< The replace string */
     AC_PATTID_t id;   /**< Pattern identifier */
+    unsigned int flags; /**< Bitwise OR of AC_PATTFLAG_* values; 0 for none. 
+                         * Read by ac_trie_add_flags() only, which requires 
+                         * it to be initialized and rejects undefined bits */
 } AC_PATTERN_t;
 
 /**
@@ -120,7 +153,25 @@ typedef enum ac_status
     ACERR_DUPLICATE_PATTERN,    /**< Duplicate patterns */
     ACERR_LONG_PATTERN,         /**< Pattern length is too long */
     ACERR_ZERO_PATTERN,         /**< Empty pattern (zero length) */
-    ACERR_TRIE_CLOSED       /**< Trie is closed. */
+    ACERR_TRIE_CLOSED,      /**< Trie is closed. */
+    ACERR_TRIE_NOT_EMPTY,   /**< Trie settings must be made before adding 
+                             * patterns */
+    ACERR_NOCASE_DISABLED,  /**< Case-insensitive pattern in a trie which is 
+                             * not in AC_CASE_PER_PATTERN mode */
+    ACERR_TRIE_OPEN,        /**< Trie is not finalized yet */
+    ACERR_MEMORY_BUDGET,    /**< The pattern would take the trie beyond its 
+                             * memory budget */
+    ACERR_NO_COUNTERS,      /**< The library is built without AC_COUNTERS */
+    ACERR_STREAM_SPACE,     /**< The buffer is too small for the stream 
+                             * state */
+    ACERR_STREAM_STATE,     /**< The stream state is corrupt, or it belongs 
+                             * to another trie */
+    ACERR_PATTERN_FLAGS,    /**< The pattern has flags outside 
+                             * AC_PATTFLAG_MASK */
+    ACERR_UNKNOWN_ENGINE,   /**< Not one of the AC_ENGINE_t values */
+    ACERR_BUFFER_SIZE       /**< The replacement buffer size is outside 
+                             * MF_REPLACEMENT_BUFFER_MIN and 
+                             * MF_REPLACEMENT_BUFFER_MAX */
 } AC_STATUS_t;
 
 /**
@@ -141,13 +192,20 @@ typedef int (*AC_MATCH_CALBACK_f)(AC_MATCH_t *, void *);
  */
 typedef void (*MF_REPLACE_CALBACK_f)(AC_TEXT_t *, void *);
 
+/**
+ * @brief Call-back function to receive the replacement text as a vector of 
+ * segments; see multifast_replacev().
+ */
+typedef void (*MF_REPLACE_SEGMENTS_CALBACK_f)
+        (const AC_TEXT_t *, size_t, void *);
+
 /**
  * Maximum accepted length of search/replace pattern
  */
 #define AC_PATTRN_MAX_LENGTH 1024
 
 /**
- * Replacement buffer size 
+ * Default replacement buffer size; see ac_trie_setbuffer()
  */
 #define MF_REPLACEMENT_BUFFER_SIZE 2048
 
@@ -155,12 +213,92 @@ typedef void (*MF_REPLACE_CALBACK_f)(AC_TEXT_t *, void *);
 #error "REPLACEMENT_BUFFER_SIZE must be bigger than AC_PATTRN_MAX_LENGTH"
 #endif
 
-typedef enum act_working_mode
+/**
+ * Range of the replacement buffer size of ac_trie_setbuffer(). A buffer 
+ * smaller than the longest pattern would be passed to the call-back after 
+ * nearly every replacement. The tests build with a smaller minimum, so that 
+ * their short texts fill the buffer.
+ */
+#ifndef MF_REPLACEMENT_BUFFER_MIN
+#define MF_REPLACEMENT_BUFFER_MIN AC_PATTRN_MAX_LENGTH
+#endif
+#define MF_REPLACEMENT_BUFFER_MAX 0x40000000
+
+/**
+ * Maximum number of the segments of multifast_replacev() that are passed to 
+ * the call-back function at once
+ */
+#define MF_REPLACEMENT_SEGMENTS 64
+
+/**
+ * Size of the windows that multifast_replace_inplace() feeds to the trie, 
+ * which bounds the nominees that are held at a time. The tests build with 
+ * a small one.
+ */
+#ifndef MF_REPLACEMENT_WINDOW
+#define MF_REPLACEMENT_WINDOW 65536
+#endif
+
+/**
+ * Size of the segments that multifast_replace_parallel() gives to its 
+ * threads. The tests build with a small one.
+ */
+#ifndef MF_PARALLEL_SEGMENT
+#define MF_PARALLEL_SEGMENT (1024 * 1024)
+#endif
+
+/**
+ * Case sensitivity of the trie
+ * 
+ * In a case-insensitive trie the ASCII letters of the patterns and of the 
+ * input text are folded to lower case while they pass through the automaton;
+ * the input text itself is never modified.
+ */
+typedef enum ac_case_mode
+{
+    AC_CASE_SENSITIVE = 0,  /**< Default: bytes are compared as they are */
+    AC_CASE_INSENSITIVE,    /**< All patterns ignore case */
+    AC_CASE_PER_PATTERN     /**< Only the patterns flagged with 
+                             * AC_PATTFLAG_NOCASE ignore case; the others are 
+                             * verified against the input text */
+} AC_CASE_MODE_t;
+
+/**
+ * Search engines of the trie
+ * 
+ * All the engines report the same matches through the same API; they differ 
+ * in how they skip the parts of the input text that can not contain a match.
+ * The engine is chosen at finalize. If the requested engine does not fit the 
+ * patterns, e.g. a pattern is too short for it, the trie falls back to 
+ * AC_ENGINE_STARTBYTES.
+ */
+typedef enum ac_engine
+{
+    AC_ENGINE_AUTO = 0,     /**< Default: choose by the pattern set */
+    AC_ENGINE_AUTOMATON,    /**< Only the automaton, byte by byte */
+    AC_ENGINE_STARTBYTES,   /**< Skip the bytes that can not start a pattern */
+    AC_ENGINE_TEDDY,        /**< SIMD lookup of the first bytes of the 
+                             * patterns; for small pattern sets */
+    AC_ENGINE_WUMANBER      /**< Wu-Manber block shift table; for patterns 
+                             * which are all long */
+} AC_ENGINE_t;
+
+/**
+ * Page modes of the automaton memory
+ * 
+ * On automata of several gigabytes, the TLB misses of the ordinary 4 KB 
+ * pages take a significant part of the search time; 2 MB pages avoid most 
+ * of them. Huge pages are only available on Linux.
+ */
+typedef enum ac_pages
 {
-    AC_WORKING_MODE_SEARCH = 0, /* Default */
-    AC_WORKING_MODE_FINDNEXT,
-    AC_WORKING_MODE_REPLACE     /* Not used */
-} ACT_WORKING_MODE_t;
+    AC_PAGES_DEFAULT = 0,   /**< Default: ordinary pages */
+    AC_PAGES_HUGE,          /**< Transparent huge pages: 2 MB aligned 
+                             * mappings advised with MADV_HUGEPAGE */
+    AC_PAGES_HUGETLB        /**< Explicit huge pages from hugetlbfs 
+                             * (MAP_HUGETLB); falls back to AC_PAGES_HUGE if 
+                             * none is available */
+} AC_PAGES_t;
 
 
 #ifdef __cplusplus
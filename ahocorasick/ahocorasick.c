@@ -21,10 +21,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef AC_COUNTERS
+#include <time.h>
+#endif
 
 #include "node.h"
 #include "ahocorasick.h"
 #include "mpool.h"
+#include "prefilter.h"
 
 /* Privates */
 
@@ -37,11 +41,66 @@ static void ac_trie_traverse_setfailure
 static void ac_trie_traverse_action 
     (ACT_NODE_t *node, void(*func)(ACT_NODE_t *), int top_down);
 
-static void ac_trie_reset 
+static ACT_NODE_t *ac_trie_advance (AC_TRIE_t *thiz, AC_TEXT_t *text, 
+        size_t *position, ACT_NODE_t **current);
+
+static size_t ac_trie_get_match (AC_TRIE_t *thiz, ACT_NODE_t *node, 
+        size_t position, int eot, AC_MATCH_t *match);
+
+static int ac_trie_report_match (AC_TRIE_t *thiz, ACT_NODE_t *node, 
+        size_t position, int eot, AC_MATCH_CALBACK_f callback, void *user);
+
+static int ac_trie_findmatch 
+    (AC_TRIE_t *thiz);
+
+static int ac_trie_getchar (AC_TRIE_t *thiz, const AC_TEXT_t *text, 
+        size_t offset, size_t position, AC_ALPHABET_t *alpha);
+
+static size_t ac_trie_max_matched 
+    (ACT_NODE_t *node);
+
+static int ac_trie_is_duplicate 
+    (AC_TRIE_t *thiz, ACT_NODE_t *node, AC_PATTERN_t *patt);
+
+static int ac_trie_verify (AC_TRIE_t *thiz, AC_PATTERN_t *patt, 
+        const AC_TEXT_t *text, size_t offset, size_t start);
+
+static void ac_trie_update_xlat 
+    (AC_TRIE_t *thiz);
+
+static size_t ac_trie_count_nodes 
+    (ACT_NODE_t *node);
+
+static void ac_trie_number_nodes 
+    (AC_TRIE_t *thiz);
+
+static void ac_trie_build_lookahead 
+    (AC_TRIE_t *thiz);
+
+static size_t ac_trie_automaton_size 
     (AC_TRIE_t *thiz);
 
-static int ac_trie_match_handler 
-    (AC_MATCH_t * matchp, void * param);
+static size_t ac_trie_pattern_size 
+    (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy);
+
+#ifdef AC_COUNTERS
+static void ac_trie_number_patterns 
+    (AC_TRIE_t *thiz);
+#endif
+
+/* Publics (used by replace.c) */
+
+void ac_trie_reset (AC_TRIE_t *thiz);
+int  ac_trie_check_match 
+    (AC_TRIE_t *thiz, AC_PATTERN_t *patt, size_t position, int eot);
+int  ac_trie_check_text (AC_TRIE_t *thiz, AC_PATTERN_t *patt, 
+        const AC_TEXT_t *text, size_t offset, size_t position, int eot);
+void ac_trie_keep_history (AC_TRIE_t *thiz, AC_TEXT_t *text, size_t depth);
+unsigned int ac_trie_pattern_checks (AC_TRIE_t *thiz, AC_PATTERN_t *patt);
+#ifdef AC_COUNTERS
+void ac_trie_count_hit (AC_TRIE_t *thiz, ACT_NODE_t *node, AC_PATTERN_t *patt);
+unsigned long long ac_trie_clock (void);
+#endif
 
 /* Friends */
 
@@ -50,6 +109,39 @@ extern void mf_repdata_reset (MF_REPLACEMENT_DATA_t *rd);
 extern void mf_repdata_release (MF_REPLACEMENT_DATA_t *rd);
 extern void mf_repdata_allocbuf (MF_REPLACEMENT_DATA_t *rd);
 
+/**
+ * ASCII case folding table
+ */
+static const AC_ALPHABET_t ac_fold_table[256] = {
+    '\x00', '\x01', '\x02', '\x03', '\x04', '\x05', '\x06', '\x07',
+    '\x08', '\x09', '\x0a', '\x0b', '\x0c', '\x0d', '\x0e', '\x0f',
+    '\x10', '\x11', '\x12', '\x13', '\x14', '\x15', '\x16', '\x17',
+    '\x18', '\x19', '\x1a', '\x1b', '\x1c', '\x1d', '\x1e', '\x1f',
+    ' ', '!', '"', '#', '$', '%', '&', '\'', '(', ')', '*', '+', ',', '-', 
+    '.', '/', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', ':', ';', 
+    '<', '=', '>', '?', '@', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 
+    'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 
+    'x', 'y', 'z', '[', '\\', ']', '^', '_', '`', 'a', 'b', 'c', 'd', 'e', 
+    'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 
+    't', 'u', 'v', 'w', 'x', 'y', 'z', '{', '|', '}', '~', '\x7f',
+    '\x80', '\x81', '\x82', '\x83', '\x84', '\x85', '\x86', '\x87',
+    '\x88', '\x89', '\x8a', '\x8b', '\x8c', '\x8d', '\x8e', '\x8f',
+    '\x90', '\x91', '\x92', '\x93', '\x94', '\x95', '\x96', '\x97',
+    '\x98', '\x99', '\x9a', '\x9b', '\x9c', '\x9d', '\x9e', '\x9f',
+    '\xa0', '\xa1', '\xa2', '\xa3', '\xa4', '\xa5', '\xa6', '\xa7',
+    '\xa8', '\xa9', '\xaa', '\xab', '\xac', '\xad', '\xae', '\xaf',
+    '\xb0', '\xb1', '\xb2', '\xb3', '\xb4', '\xb5', '\xb6', '\xb7',
+    '\xb8', '\xb9', '\xba', '\xbb', '\xbc', '\xbd', '\xbe', '\xbf',
+    '\xc0', '\xc1', '\xc2', '\xc3', '\xc4', '\xc5', '\xc6', '\xc7',
+    '\xc8', '\xc9', '\xca', '\xcb', '\xcc', '\xcd', '\xce', '\xcf',
+    '\xd0', '\xd1', '\xd2', '\xd3', '\xd4', '\xd5', '\xd6', '\xd7',
+    '\xd8', '\xd9', '\xda', '\xdb', '\xdc', '\xdd', '\xde', '\xdf',
+    '\xe0', '\xe1', '\xe2', '\xe3', '\xe4', '\xe5', '\xe6', '\xe7',
+    '\xe8', '\xe9', '\xea', '\xeb', '\xec', '\xed', '\xee', '\xef',
+    '\xf0', '\xf1', '\xf2', '\xf3', '\xf4', '\xf5', '\xf6', '\xf7',
+    '\xf8', '\xf9', '\xfa', '\xfb', '\xfc', '\xfd', '\xfe', '\xff'
+};
+
 
 /**
  * @brief Initializes the trie; allocates memories and sets initial values
@@ -59,26 +151,439 @@ extern void mf_repdata_allocbuf (MF_REPLACEMENT_DATA_t *rd);
 AC_TRIE_t *ac_trie_create (void)
 {
     AC_TRIE_t *thiz = (AC_TRIE_t *) malloc (sizeof(AC_TRIE_t));
-    thiz->mp = mpool_create(0);
+    thiz->mp = mpool_create(0, MPOOL_PAGES_DEFAULT);
+    thiz->string_mp = mpool_create(0, MPOOL_PAGES_DEFAULT);
+    thiz->frozen = 0;
+    thiz->freeze_before = 0;
+    thiz->freeze_after = 0;
+    thiz->vectors_size = 0;
+    thiz->memory_budget = 0;
+    
+    memset (&thiz->counters, 0, sizeof(AC_COUNTERS_t));
+    thiz->hits = NULL;
+    thiz->hits_base = NULL;
+    
+    thiz->case_mode = AC_CASE_SENSITIVE;
+    thiz->map = NULL;
+    thiz->xlat = NULL;
     
     thiz->root = node_create (thiz);
+    thiz->nodes = NULL;
+    thiz->nodes_count = 0;
+    thiz->engine = AC_ENGINE_AUTO;
+    thiz->prefetch = 0;
+    thiz->prefilter = NULL;
     
     thiz->patterns_count = 0;
+    thiz->patterns_checks = 0;
+    
+    thiz->history.astring = NULL;
+    thiz->history.length = 0;
+    thiz->filtered = NULL;
     
     mf_repdata_init (thiz);
     ac_trie_reset (thiz);    
     thiz->text = NULL;
     thiz->position = 0;
+    thiz->match.size = 0;
+    thiz->match_index = 0;
+    thiz->text_done = 1;
     
-    thiz->wm = AC_WORKING_MODE_SEARCH;
     thiz->trie_open = 1;
     
     return thiz;
 }
 
+/**
+ * @brief Sets the case sensitivity of the trie. It must be called before 
+ * adding any pattern.
+ * 
+ * The case folding is done inside the automaton, so the input text is 
+ * neither copied nor modified.
+ * 
+ * @param thiz pointer to the trie
+ * @param mode the case sensitivity mode
+ * 
+ * @return The return value indicates the success or failure of the action
+ *****************************************************************************/
+AC_STATUS_t ac_trie_setcase (AC_TRIE_t *thiz, AC_CASE_MODE_t mode)
+{
+    if (!thiz->trie_open)
+        return ACERR_TRIE_CLOSED;
+    
+    if (thiz->patterns_count)
+        return ACERR_TRIE_NOT_EMPTY;
+    
+    thiz->case_mode = mode;
+    ac_trie_update_xlat (thiz);
+    
+    return ACERR_SUCCESS;
+}
+
+/**
+ * @brief Sets a character mapping for the trie. It must be called before 
+ * adding any pattern.
+ * 
+ * The mapping is a table of 256 alphabets indexed by the byte value. Every 
+ * byte of the patterns and of the input text is replaced by its mapped value
+ * before it enters the automaton, e.g. to make some bytes equivalent or to 
+ * map all the digits to a single class. The mapping is applied inside the 
+ * transition lookup, so the input text is neither copied nor modified, and 
+ * the reported patterns and replacement results keep the original bytes. 
+ * Case folding (see ac_trie_setcase) is applied after the mapping. The 
+ * boundary flags are checked on the original bytes.
+ * 
+ * @param thiz pointer to the trie
+ * @param map the mapping table; the trie makes a copy of it. NULL removes 
+ * the mapping.
+ * 
+ * @return The return value indicates the success or failure of the action
+ *****************************************************************************/
+AC_STATUS_t ac_trie_setmap (AC_TRIE_t *thiz, const AC_ALPHABET_t *map)
+{
+    if (!thiz->trie_open)
+        return ACERR_TRIE_CLOSED;
+    
+    if (thiz->patterns_count)
+        return ACERR_TRIE_NOT_EMPTY;
+    
+    if (map)
+    {
+        memcpy (thiz->map_table, map, sizeof(thiz->map_table));
+        thiz->map = thiz->map_table;
+    }
+    else
+    {
+        thiz->map = NULL;
+    }
+    
+    ac_trie_update_xlat (thiz);
+    
+    return ACERR_SUCCESS;
+}
+
+/**
+ * @brief Selects the search engine of the trie. It must be called before 
+ * finalizing the trie.
+ * 
+ * By default the engine is chosen at finalize: Teddy for up to 
+ * AC_PREFILTER_TEDDY_MAX_PATTERNS patterns, Wu-Manber if all the patterns 
+ * are at least AC_PREFILTER_WM_MIN_LENGTH bytes long, otherwise the start 
+ * bytes skip. After finalizing, thiz->engine holds the engine in use.
+ * 
+ * @param thiz pointer to the trie
+ * @param engine the search engine
+ * 
+ * @return ACERR_SUCCESS, ACERR_TRIE_CLOSED, or ACERR_UNKNOWN_ENGINE for a 
+ * value that is not an AC_ENGINE_t; the engine is left unchanged on error
+ *****************************************************************************/
+AC_STATUS_t ac_trie_setengine (AC_TRIE_t *thiz, AC_ENGINE_t engine)
+{
+    if (!thiz->trie_open)
+        return ACERR_TRIE_CLOSED;
+    
+    if ((unsigned int) engine > AC_ENGINE_WUMANBER)
+        return ACERR_UNKNOWN_ENGINE;
+    
+    thiz->engine = engine;
+    
+    return ACERR_SUCCESS;
+}
+
+/**
+ * @brief Sets the lookahead distance of the software prefetch in the search 
+ * loop. It can be changed at any time.
+ * 
+ * With a non-0 distance, ac_trie_search() looks at the byte that is 
+ * @p distance positions ahead and prefetches the child of the root for that 
+ * byte along with its edges, so that these are in the cache when the 
+ * automaton gets there. This pays off on automata much larger than the CPU 
+ * cache and costs a little on small ones; the best distance depends on the 
+ * machine and should be measured; a distance between 4 and 16 is a good 
+ * start.
+ * 
+ * @param thiz pointer to the trie
+ * @param distance the lookahead distance in bytes; 0 disables the prefetch
+ *****************************************************************************/
+void ac_trie_setprefetch (AC_TRIE_t *thiz, size_t distance)
+{
+    thiz->prefetch = distance;
+}
+
+/**
+ * @brief Sets the number of memory pools that the calling thread keeps from 
+ * the released tries for the next tries it creates.
+ * 
+ * Threads which create and release short-lived tries at a high rate can 
+ * enable this to reuse the pool blocks instead of going to the allocator 
+ * each time. The cache is disabled by default. Calling it with 0 releases 
+ * the cached pools. On POSIX systems the pools are also released when the 
+ * thread exits; on other systems the thread must call it with 0 before it 
+ * exits, or the cached pools leak. Note that a released trie goes to the 
+ * cache of the thread which calls ac_trie_release().
+ * 
+ * @param count maximum number of the cached pools; 0 disables the cache
+ *****************************************************************************/
+void ac_trie_setpoolcache (size_t count)
+{
+    mpool_setcache (count);
+}
+
+/**
+ * @brief Sets the page mode of the automaton memory. It must be called 
+ * before adding any pattern.
+ * 
+ * The nodes and the pattern strings are allocated from the memory pool of 
+ * the trie; in the huge page modes the pool is made of 2 MB pages. Use 
+ * ac_trie_hugepages() to find out whether the huge pages were obtained.
+ * 
+ * @param thiz pointer to the trie
+ * @param mode the page mode
+ * 
+ * @return The return value indicates the success or failure of the action
+ *****************************************************************************/
+AC_STATUS_t ac_trie_setpages (AC_TRIE_t *thiz, AC_PAGES_t mode)
+{
+    if (!thiz->trie_open)
+        return ACERR_TRIE_CLOSED;
+    
+    if (thiz->patterns_count)
+        return ACERR_TRIE_NOT_EMPTY;
+    
+    switch (mode)
+    {
+        case AC_PAGES_HUGE:
+            mpool_setpages (thiz->mp, MPOOL_PAGES_HUGE);
+            break;
+        case AC_PAGES_HUGETLB:
+            mpool_setpages (thiz->mp, MPOOL_PAGES_HUGETLB);
+            break;
+        default:
+            mpool_setpages (thiz->mp, MPOOL_PAGES_DEFAULT);
+            break;
+    }
+    
+    return ACERR_SUCCESS;
+}
+
+/**
+ * @brief Finds how much of the automaton memory is backed by huge pages
+ * 
+ * The transparent huge pages are counted from the kernel's per mapping 
+ * figures, so the result is an upper bound for them.
+ * 
+ * @param thiz pointer to the trie
+ * @return the number of bytes in huge pages; 0 if none was obtained
+ *****************************************************************************/
+size_t ac_trie_hugepages (AC_TRIE_t *thiz)
+{
+    return mpool_hugepages (thiz->mp);
+}
+
+/**
+ * @brief Sets the memory budget of the trie
+ * 
+ * Once the trie is at the budget, ac_trie_add() rejects the patterns with 
+ * ACERR_MEMORY_BUDGET instead of allocating more memory. The check is done 
+ * before each pattern is added, based on ac_trie_memory() and an estimate 
+ * of what the new pattern takes, including any new memory pool block. The 
+ * edge vectors of the nodes grow in small steps which are not estimated 
+ * exactly, so the trie may exceed the budget by a few bytes.
+ * 
+ * @param thiz pointer to the trie
+ * @param bytes the budget in bytes; 0 for no limit
+ *****************************************************************************/
+void ac_trie_setbudget (AC_TRIE_t *thiz, size_t bytes)
+{
+    thiz->memory_budget = bytes;
+}
+
+/**
+ * @brief Sets the size of the replacement buffer. It must be called before 
+ * finalizing the trie.
+ * 
+ * multifast_replace() collects its output in the buffer and passes it to the 
+ * call-back function whenever the buffer is full; a bigger buffer means 
+ * fewer calls, e.g. fewer write() system calls. A piece of the output which 
+ * is at least as big as the buffer, such as a long part of the input text 
+ * without any pattern, is passed to the call-back directly instead of being 
+ * copied through the buffer.
+ * 
+ * @param thiz pointer to the trie
+ * @param size the buffer size in bytes, from MF_REPLACEMENT_BUFFER_MIN 
+ * (AC_PATTRN_MAX_LENGTH) to MF_REPLACEMENT_BUFFER_MAX (1 GB); 0 for the 
+ * default, which is MF_REPLACEMENT_BUFFER_SIZE
+ * 
+ * @return The return value indicates the success or failure of the action; 
+ * ACERR_BUFFER_SIZE if the size is outside the range
+ *****************************************************************************/
+AC_STATUS_t ac_trie_setbuffer (AC_TRIE_t *thiz, size_t size)
+{
+    if (!thiz->trie_open)
+        return ACERR_TRIE_CLOSED;
+    
+    if (size && (size < MF_REPLACEMENT_BUFFER_MIN || 
+            size > MF_REPLACEMENT_BUFFER_MAX))
+        return ACERR_BUFFER_SIZE;
+    
+    thiz->repdata.buffer_size = size ? size : MF_REPLACEMENT_BUFFER_SIZE;
+    
+    return ACERR_SUCCESS;
+}
+
+/**
+ * @brief Finds the memory that the trie is holding
+ * 
+ * It counts the memory pool blocks, the edge and pattern vectors of the 
+ * nodes, the prefilter tables and the search and replacement buffers.
+ * 
+ * @param thiz pointer to the trie
+ * @return the size in bytes
+ *****************************************************************************/
+size_t ac_trie_memory (AC_TRIE_t *thiz)
+{
+    size_t bytes;
+    
+    bytes = sizeof(AC_TRIE_t) + thiz->vectors_size + 
+            mpool_size (thiz->mp) + mpool_size (thiz->string_mp);
+    
+    if (thiz->prefilter)
+        bytes += prefilter_size (thiz->prefilter);
+    
+    return bytes;
+}
+
+/**
+ * @brief Collects the statistics of the trie
+ * 
+ * It walks all the nodes of the automaton, so it is meant for diagnostics 
+ * rather than for the hot path.
+ * 
+ * @param thiz pointer to the trie
+ * @param stats receives the statistics
+ * 
+ * @return The return value indicates the success or failure of the action
+ *****************************************************************************/
+AC_STATUS_t ac_trie_stats (AC_TRIE_t *thiz, AC_TRIE_STATS_t *stats)
+{
+    ACT_NODE_t *node;
+    size_t i, *chain, depths = 0, chains = 0;
+    
+    if (thiz->trie_open)
+        return ACERR_TRIE_OPEN;
+    
+    memset (stats, 0, sizeof(AC_TRIE_STATS_t));
+    
+    /* The failure chain length of each node, indexed by id. The failure 
+     * node is always shallower, so in the breadth-first order it comes 
+     * first. */
+    chain = (size_t *) malloc (thiz->nodes_count * sizeof(size_t));
+    
+    for (i = 0; i < thiz->nodes_count; i++)
+    {
+        node = thiz->nodes[i];
+        
+        chain[i] = node->failure_node ? chain[node->failure_node->id] + 1 : 0;
+        
+        stats->edges_count += node->outgoing_size;
+        stats->matched_count += node->matched_size;
+        if (node->final)
+            stats->final_count++;
+        
+        if (node->depth > stats->max_depth)
+            stats->max_depth = node->depth;
+        if (chain[i] > stats->max_chain)
+            stats->max_chain = chain[i];
+        depths += node->depth;
+        chains += chain[i];
+        
+        stats->fanout[node->outgoing_size]++;
+        stats->chain[chain[i] < AC_STATS_CHAIN_BUCKETS ? 
+                chain[i] : AC_STATS_CHAIN_BUCKETS - 1]++;
+        
+        stats->memory_edges += 
+                node->outgoing_capacity * sizeof(struct act_edge);
+        stats->memory_matched += 
+                node->matched_capacity * sizeof(AC_PATTERN_t);
+    }
+    
+    free (chain);
+    
+    stats->nodes_count = thiz->nodes_count;
+    stats->avg_depth = (double) depths / thiz->nodes_count;
+    stats->avg_chain = (double) chains / thiz->nodes_count;
+    
+    stats->memory_nodes = thiz->nodes_count * sizeof(ACT_NODE_t);
+    stats->memory_strings = mpool_size (thiz->string_mp);
+    stats->memory_total = ac_trie_memory (thiz);
+    stats->memory_other = stats->memory_total - stats->memory_nodes - 
+            stats->memory_edges - stats->memory_matched - 
+            stats->memory_strings;
+    
+    return ACERR_SUCCESS;
+}
+
+/**
+ * @brief Takes a snapshot of the runtime counters of the trie
+ * 
+ * The counters are only maintained when the library is built with 
+ * AC_COUNTERS defined; otherwise the search and replace loops carry no 
+ * trace of them and this function returns ACERR_NO_COUNTERS. The counters 
+ * accumulate over all the searches and replacements of the trie.
+ * 
+ * @param thiz pointer to the trie
+ * @param counters receives the counters
+ * @param hits receives the hits of every pattern; it must have room for 
+ * thiz->patterns_count entries. NULL if not needed.
+ * 
+ * @return The return value indicates the success or failure of the action
+ *****************************************************************************/
+AC_STATUS_t ac_trie_counters (AC_TRIE_t *thiz, 
+        AC_COUNTERS_t *counters, AC_PATTERN_HITS_t *hits)
+{
+#ifdef AC_COUNTERS
+    ACT_NODE_t *node;
+    size_t i, j;
+    
+    if (thiz->trie_open)
+        return ACERR_TRIE_OPEN;
+    
+    *counters = thiz->counters;
+    
+    if (hits)
+    {
+        for (i = 0; i < thiz->nodes_count; i++)
+        {
+            node = thiz->nodes[i];
+            
+            /* The node's own patterns come first in its matched vector */
+            for (j = 0; j < node->matched_size && 
+                    node->matched[j].ptext.length == node->depth; j++)
+            {
+                hits[thiz->hits_base[i] + j].pattern = &node->matched[j];
+                hits[thiz->hits_base[i] + j].hits = 
+                        thiz->hits[thiz->hits_base[i] + j];
+            }
+        }
+    }
+    
+    return ACERR_SUCCESS;
+#else
+    (void) thiz;
+    (void) counters;
+    (void) hits;
+    
+    return ACERR_NO_COUNTERS;
+#endif
+}
+
 /**
  * @brief Adds pattern to the trie.
  * 
+ * The 'flags' field of the pattern is not read: the pattern is added with 
+ * no flags, as it was before the flags existed. Use ac_trie_add_flags() to 
+ * add a pattern with its flags.
+ * 
  * @param Thiz pointer to the trie
  * @param Patt pointer to the pattern
  * @param copy should trie make a copy of patten strings or not, if not, 
@@ -89,6 +594,27 @@ AC_TRIE_t *ac_trie_create (void)
  * @return The return value indicates the success or failure of adding action
  *****************************************************************************/
 AC_STATUS_t ac_trie_add (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy)
+{
+    AC_PATTERN_t plain = *patt;
+    
+    plain.flags = AC_PATTFLAG_NONE;
+    
+    return ac_trie_add_flags (thiz, &plain, copy);
+}
+
+/**
+ * @brief Adds pattern to the trie, along with its flags.
+ * 
+ * Same as ac_trie_add(), but the 'flags' field of the pattern is honoured; 
+ * it must be initialized, and bits outside AC_PATTFLAG_MASK are rejected.
+ * 
+ * @param Thiz pointer to the trie
+ * @param Patt pointer to the pattern
+ * @param copy see ac_trie_add()
+ * 
+ * @return The return value indicates the success or failure of adding action
+ *****************************************************************************/
+AC_STATUS_t ac_trie_add_flags (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy)
 {
     size_t i;
     ACT_NODE_t *n = thiz->root;
@@ -104,9 +630,23 @@ AC_STATUS_t ac_trie_add (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy)
     if (patt->ptext.length > AC_PATTRN_MAX_LENGTH)
         return ACERR_LONG_PATTERN;
     
+    if (patt->flags & ~AC_PATTFLAG_MASK)
+        return ACERR_PATTERN_FLAGS;
+    
+    if ((patt->flags & AC_PATTFLAG_NOCASE) && 
+            thiz->case_mode != AC_CASE_PER_PATTERN)
+        return ACERR_NOCASE_DISABLED;
+    
+    if (thiz->memory_budget && ac_trie_memory (thiz) + 
+            ac_trie_pattern_size (thiz, patt, copy) > thiz->memory_budget)
+        return ACERR_MEMORY_BUDGET;
+    
     for (i = 0; i < patt->ptext.length; i++)
     {
         alpha = patt->ptext.astring[i];
+        if (thiz->xlat)
+            alpha = thiz->xlat[(unsigned char) alpha];
+        
         if ((next = node_find_next (n, alpha)))
         {
             n = next;
@@ -120,206 +660,883 @@ AC_STATUS_t ac_trie_add (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy)
         }
     }
     
-    if(n->final)
+    if (ac_trie_is_duplicate (thiz, n, patt))
         return ACERR_DUPLICATE_PATTERN;
     
     n->final = 1;
     node_accept_pattern (n, patt, copy);
     thiz->patterns_count++;
+    thiz->patterns_checks |= ac_trie_pattern_checks (thiz, patt);
+    
+    return ACERR_SUCCESS;
+}
+
+/**
+ * @brief Finalizes the preprocessing stage and gets the trie ready
+ * 
+ * Locates the failure node for all nodes and collects all matched 
+ * pattern for each node. It also sorts outgoing edges of node, so binary 
+ * search could be performed on them. After calling this function the automate 
+ * will be finalized and you can not add new patterns to the automate.
+ * 
+ * @param thiz pointer to the trie
+ *****************************************************************************/
+void ac_trie_finalize (AC_TRIE_t *thiz)
+{
+    AC_ALPHABET_t prefix[AC_PATTRN_MAX_LENGTH]; 
+    
+    /* 'prefix' defined here, because ac_trie_traverse_setfailure() calls
+     * itself recursively */
+    ac_trie_traverse_setfailure (thiz->root, prefix);
+    
+    ac_trie_traverse_action (thiz->root, node_collect_matches, 1);
+    ac_trie_number_nodes (thiz);
+    ac_trie_build_lookahead (thiz);
+#ifdef AC_COUNTERS
+    ac_trie_number_patterns (thiz);
+#endif
+    mf_repdata_allocbuf (&thiz->repdata);
+    
+    if (thiz->patterns_checks)
+    {
+        /* Boundary checks may need to look back as far as the longest 
+         * pattern plus one byte */
+        thiz->history.astring = (AC_ALPHABET_t *) 
+                malloc ((AC_PATTRN_MAX_LENGTH + 1) * sizeof(AC_ALPHABET_t));
+        
+        thiz->filtered = (AC_PATTERN_t *) malloc 
+                (ac_trie_max_matched (thiz->root) * sizeof(AC_PATTERN_t));
+        
+        thiz->vectors_size += (AC_PATTRN_MAX_LENGTH + 1) * 
+                sizeof(AC_ALPHABET_t) + 
+                ac_trie_max_matched (thiz->root) * sizeof(AC_PATTERN_t);
+    }
+    
+    thiz->prefilter = prefilter_create (thiz, thiz->engine);
+    thiz->engine = thiz->prefilter ? 
+            thiz->prefilter->engine : AC_ENGINE_AUTOMATON;
+    
+    thiz->trie_open = 0; /* Do not accept patterns any more */
+}
+
+/**
+ * @brief Compacts the finalized automaton into one contiguous region.
+ * 
+ * While the patterns are being added, the edge and pattern vectors of the 
+ * nodes grow with slack capacity, and the nodes are spread over the memory
+ * pool in the order they were created. This function copies the nodes in 
+ * breadth-first order, followed by all the right-sized vectors, into one 
+ * region and releases the old memory. The pattern strings are kept in their 
+ * own pool, which is already packed. The trie must not be in the middle of 
+ * a search or replace. The sizes of the automaton before and after the 
+ * compaction are kept in thiz->freeze_before and thiz->freeze_after.
+ * 
+ * @param thiz pointer to the trie
+ * 
+ * @return The return value indicates the success or failure of the action
+ *****************************************************************************/
+AC_STATUS_t ac_trie_freeze (AC_TRIE_t *thiz)
+{
+    struct mpool *region;
+    ACT_NODE_t *old, *nodes, **index;
+    struct act_edge *edges;
+    AC_PATTERN_t *matched;
+    size_t i, j, edges_count = 0, matched_count = 0;
+    size_t n = thiz->nodes_count;
+    
+    if (thiz->trie_open)
+        return ACERR_TRIE_OPEN;
+    
+    if (thiz->frozen)
+        return ACERR_SUCCESS;
+    
+    thiz->freeze_before = ac_trie_automaton_size (thiz);
+    
+    for (i = 0; i < n; i++)
+    {
+        edges_count += thiz->nodes[i]->outgoing_size;
+        matched_count += thiz->nodes[i]->matched_size;
+    }
+    
+    /* Allocate the whole region at once; mpool_malloc() rounds every 
+     * allocation up to 16 bytes */
+    region = mpool_create (((n * sizeof(ACT_NODE_t) + 15) & ~0xF) + 
+            ((edges_count * sizeof(struct act_edge) + 15) & ~0xF) + 
+            ((matched_count * sizeof(AC_PATTERN_t) + 15) & ~0xF) + 
+            ((n * sizeof(ACT_NODE_t *) + 15) & ~0xF), 
+            mpool_getpages (thiz->mp));
+    
+    nodes = (ACT_NODE_t *) mpool_malloc (region, n * sizeof(ACT_NODE_t));
+    edges = (struct act_edge *) mpool_malloc 
+            (region, edges_count * sizeof(struct act_edge));
+    matched = (AC_PATTERN_t *) mpool_malloc 
+            (region, matched_count * sizeof(AC_PATTERN_t));
+    index = (ACT_NODE_t **) mpool_malloc (region, n * sizeof(ACT_NODE_t *));
+    
+    /* The node ids are their breadth-first indices, so the new address of 
+     * every node is known in advance */
+    for (i = 0; i < n; i++)
+    {
+        old = thiz->nodes[i];
+        nodes[i] = *old;
+        index[i] = &nodes[i];
+        
+        if (old->failure_node)
+            nodes[i].failure_node = &nodes[old->failure_node->id];
+        
+        nodes[i].outgoing = old->outgoing_size ? edges : NULL;
+        nodes[i].outgoing_capacity = old->outgoing_size;
+        
+        for (j = 0; j < old->outgoing_size; j++)
+        {
+            edges->alpha = old->outgoing[j].alpha;
+            edges->next = &nodes[old->outgoing[j].next->id];
+            edges++;
+        }
+        
+        nodes[i].matched = old->matched_size ? matched : NULL;
+        nodes[i].matched_capacity = old->matched_size;
+        
+        for (j = 0; j < old->matched_size; j++)
+            *matched++ = old->matched[j];
+        
+        if (old->to_be_replaced)
+            nodes[i].to_be_replaced = nodes[i].matched + 
+                    (old->to_be_replaced - old->matched);
+        
+        node_release_vectors (old);
+    }
+    
+    free (thiz->nodes);
+    thiz->vectors_size -= n * sizeof(ACT_NODE_t *);
+    mpool_free (thiz->mp);
+    
+    thiz->mp = region;
+    thiz->nodes = index;
+    thiz->root = &nodes[0];
+    thiz->frozen = 1;
+    
+    ac_trie_reset (thiz);
+    ac_trie_build_lookahead (thiz);
+    
+    thiz->freeze_after = ac_trie_automaton_size (thiz);
+    
+    return ACERR_SUCCESS;
+}
+
+/**
+ * @brief Search in the input text using the given trie.
+ * 
+ * @param thiz pointer to the trie
+ * @param text input text to be searched
+ * @param keep indicated that if the input text the successive chunk of the 
+ * previous given text or not
+ * @param callback when a match occurs this function will be called. The 
+ * call-back function in turn after doing its job, will return an integer 
+ * value, 0 means continue search, and non-0 value means stop search and return 
+ * to the caller.
+ * @param user this parameter will be send to the call-back function
+ * 
+ * If a pattern with an end boundary flag matches at the very end of the 
+ * text, its match is held back until the next chunk comes in, or until 
+ * ac_trie_search_flush() declares the end of the input.
+ * 
+ * @return
+ * -1:  failed; trie is not finalized
+ *  0:  success; input text was searched to the end
+ *  1:  success; input text was searched partially. (callback broke the loop)
+ *****************************************************************************/
+int ac_trie_search (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep, 
+        AC_MATCH_CALBACK_f callback, void *user)
+{
+    size_t position = 0;
+    ACT_NODE_t *current;
+    ACT_NODE_t *node;
+
+    if (thiz->trie_open)
+        return -1;  /* Trie must be finalized first. */
+    
+    if (!keep)
+        ac_trie_reset (thiz);
+    
+    current = thiz->last_node;
+    thiz->text = text;
+    
+    if (thiz->pending_node && text->length)
+    {
+        /* Now that the next byte is known, decide about the match that was 
+         * held back at the end of the previous chunk */
+        node = thiz->pending_node;
+        thiz->pending_node = NULL;
+        
+        if (ac_trie_report_match (thiz, node, thiz->base_position, 0, 
+                callback, user))
+            return 1;
+    }
+    
+    while ((node = ac_trie_advance (thiz, text, &position, &current)))
+    {
+        /* Found a match! */
+        if (ac_trie_report_match (thiz, node, 
+                position + thiz->base_position, 0, callback, user))
+            return 1;
+    }
+    
+    /* Save status variables */
+    ac_trie_keep_history (thiz, text, current->depth);
+    thiz->last_node = current;
+    thiz->base_position += position;
+    
+    return 0;
+}
+
+/**
+ * @brief Runs the automaton over the text up to the next final node.
+ * 
+ * This is the main search loop, shared by ac_trie_search() and 
+ * ac_trie_findnext(). It must be kept as lightweight as possible; the state 
+ * is kept in locals while the loop runs and stored back when it returns.
+ * 
+ * If the node has patterns with end boundary flags and is reached at the 
+ * very end of the text, it is held back in pending_node and the loop goes on.
+ * 
+ * @param thiz pointer to the trie
+ * @param text the input text
+ * @param position the position in the text; it is advanced
+ * @param current the current node; it is advanced
+ * @return the final node that is reached, or NULL at the end of the text
+ *****************************************************************************/
+static ACT_NODE_t *ac_trie_advance (AC_TRIE_t *thiz, AC_TEXT_t *text, 
+        size_t *position, ACT_NODE_t **current)
+{
+    size_t pos = *position;
+    ACT_NODE_t *node = *current;
+    ACT_NODE_t *next;
+    AC_ALPHABET_t alpha;
+    const AC_ALPHABET_t *xlat = thiz->xlat;
+    AC_PREFILTER_t *prefilter = thiz->prefilter;
+    size_t prefetch = thiz->prefetch;
+    unsigned char ahead;
+    
+    while (pos < text->length)
+    {
+        if (prefetch && pos + prefetch < text->length)
+        {
+            /* Warm up the node we may get to a few bytes later */
+            ahead = (unsigned char) text->astring[pos + prefetch];
+            AC_PREFETCH (thiz->root_next[ahead]);
+            AC_PREFETCH (thiz->root_edges[ahead]);
+        }
+        
+        if (prefilter && node == thiz->root && 
+                !prefilter->start[(unsigned char) text->astring[pos]])
+        {
+            /* Skip the bytes that keep us in the root node */
+            AC_COUNT (thiz->counters.skipped -= pos; 
+                    thiz->counters.bytes -= pos);
+            pos = prefilter_skip (prefilter, text->astring, 
+                    pos, text->length);
+            AC_COUNT (thiz->counters.skipped += pos; 
+                    thiz->counters.bytes += pos);
+            if (pos == text->length)
+                break;
+        }
+        
+        alpha = text->astring[pos];
+        if (xlat)
+            alpha = xlat[(unsigned char) alpha];
+        
+        if (!(next = node_find_next_bs (node, alpha)))
+        {
+            if(node->failure_node /* We are not in the root node */)
+            {
+                node = node->failure_node;
+                AC_COUNT (thiz->counters.failures++);
+            }
+            else
+            {
+                pos++;
+                AC_COUNT (thiz->counters.bytes++);
+            }
+        }
+        else
+        {
+            node = next;
+            pos++;
+            AC_COUNT (thiz->counters.gotos++; thiz->counters.bytes++);
+        }
+        
+        if (node->final && next)
+        /* We check 'next' to find out if we have come here after a alphabet
+         * transition or due to a fail transition. in second case we should not 
+         * report match, because it has already been reported */
+        {
+            if ((node->matched_checks & AC_PATTFLAG_LOOKAHEAD) && 
+                    pos == text->length)
+            {
+                /* The byte after the match is in the next chunk */
+                thiz->pending_node = node;
+                continue;
+            }
+            
+            *position = pos;
+            *current = node;
+            return node;
+        }
+    }
+    
+    *position = pos;
+    *current = node;
+    return NULL;
+}
+
+/**
+ * @brief Declares the end of the input text to the trie.
+ * 
+ * Reports the match that was held back at the end of the last chunk because
+ * it needed to see the next byte to check its end boundary.
+ * 
+ * @param thiz pointer to the trie
+ * @param callback the call-back function
+ * @param user this parameter will be send to the call-back function
+ * 
+ * @return the return value of the call-back function, or 0 if there was 
+ * nothing to report
+ *****************************************************************************/
+int ac_trie_search_flush (AC_TRIE_t *thiz, 
+        AC_MATCH_CALBACK_f callback, void *user)
+{
+    ACT_NODE_t *node = thiz->pending_node;
+    
+    if (!node)
+        return 0;
+    
+    thiz->pending_node = NULL;
+    
+    return ac_trie_report_match (thiz, node, thiz->base_position, 1, 
+            callback, user);
+}
+
+/**
+ * @brief sets the input text to be searched by a function call to _findnext()
+ * 
+ * @param thiz The pointer to the trie
+ * @param text The text to be searched. The owner of the text is the 
+ * calling program and no local copy is made, so it must be valid until you 
+ * have done with it. NULL declares the end of the input: the following 
+ * calls return the match that was held back at the end of the last chunk 
+ * to check its end boundary, if any.
+ * @param keep Indicates that if the given text is the sequel of the previous
+ * one or not; 1: it is, 0: it is not
+ *****************************************************************************/
+void ac_trie_settext (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep)
+{
+    if (!keep)
+        ac_trie_reset (thiz);
+    
+    thiz->text = text;
+    thiz->position = 0;
+    thiz->match.size = 0;
+    thiz->match_index = 0;
+    thiz->text_done = 0;
+}
+
+/**
+ * @brief finds the next match in the input text which is set by _settext()
+ * 
+ * The search resumes where the previous call stopped. Each call returns the 
+ * patterns that end at one position; if ac_trie_next() has already returned 
+ * some of them, the rest are returned. The returned patterns are valid until 
+ * the next call.
+ * 
+ * @param thiz The pointer to the trie
+ * @return The match; its size is 0 when the text is searched to the end
+ *****************************************************************************/
+AC_MATCH_t ac_trie_findnext (AC_TRIE_t *thiz)
+{
+    AC_MATCH_t match;
+    
+    if (thiz->match_index == thiz->match.size && !ac_trie_findmatch (thiz))
+    {
+        match.size = 0;
+        return match;
+    }
+    
+    match.position = thiz->match.position;
+    match.patterns = &thiz->match.patterns[thiz->match_index];
+    match.size = thiz->match.size - thiz->match_index;
+    
+    thiz->match_index = thiz->match.size;
+    
+    return match;
+}
+
+/**
+ * @brief finds the next matched pattern in the input text which is set by 
+ * _settext()
+ * 
+ * Same as ac_trie_findnext(), but returns the patterns one by one, so the 
+ * caller does not have to keep the rest of a match.
+ * 
+ * @param thiz The pointer to the trie
+ * @return The match of one pattern; its size is 0 when the text is searched 
+ * to the end
+ *****************************************************************************/
+AC_MATCH_t ac_trie_next (AC_TRIE_t *thiz)
+{
+    AC_MATCH_t match;
+    
+    if (thiz->match_index == thiz->match.size && !ac_trie_findmatch (thiz))
+    {
+        match.size = 0;
+        return match;
+    }
+    
+    match.position = thiz->match.position;
+    match.patterns = &thiz->match.patterns[thiz->match_index++];
+    match.size = 1;
+    
+    return match;
+}
+
+/**
+ * @brief Advances the search of _findnext() to the next match
+ * 
+ * @param thiz The pointer to the trie
+ * @return 1 if thiz->match holds a new match, 0 at the end of the text
+ *****************************************************************************/
+static int ac_trie_findmatch (AC_TRIE_t *thiz)
+{
+    AC_TEXT_t *text = thiz->text;
+    ACT_NODE_t *node;
+    size_t position;
+    
+    thiz->match.size = 0;
+    thiz->match_index = 0;
+    
+    if (thiz->text_done || thiz->trie_open)
+        return 0;
+    
+    if (!text)
+    {
+        /* The end of the input */
+        thiz->text_done = 1;
+        node = thiz->pending_node;
+        thiz->pending_node = NULL;
+        
+        return node && ac_trie_get_match 
+                (thiz, node, thiz->base_position, 1, &thiz->match);
+    }
+    
+    if (thiz->pending_node && text->length)
+    {
+        /* Now that the next byte is known, decide about the match that was 
+         * held back at the end of the previous chunk */
+        node = thiz->pending_node;
+        thiz->pending_node = NULL;
+        
+        if (ac_trie_get_match (thiz, node, thiz->base_position, 0, 
+                &thiz->match))
+            return 1;
+    }
+    
+    position = thiz->position;
+    
+    while ((node = ac_trie_advance (thiz, text, &position, &thiz->last_node)))
+    {
+        if (ac_trie_get_match (thiz, node, 
+                position + thiz->base_position, 0, &thiz->match))
+        {
+            thiz->position = position;
+            return 1;
+        }
+    }
+    
+    /* Save status variables; the text is done, so the next calls do not 
+     * search it again */
+    ac_trie_keep_history (thiz, text, thiz->last_node->depth);
+    thiz->base_position += position;
+    thiz->position = position;
+    thiz->text_done = 1;
+    
+    return 0;
+}
+
+/**
+ * @brief Release all allocated memories to the trie
+ * 
+ * @param thiz pointer to the trie
+ *****************************************************************************/
+void ac_trie_release (AC_TRIE_t *thiz)
+{
+    if (!thiz->frozen)
+    {
+        /* It must be called with a 0 top-down parameter */
+        ac_trie_traverse_action (thiz->root, node_release_vectors, 0);
+        free(thiz->nodes);
+    }
+    
+    mf_repdata_release (&thiz->repdata);
+    if (thiz->prefilter)
+        prefilter_release (thiz->prefilter);
+    free((AC_ALPHABET_t *)thiz->history.astring);
+    free(thiz->filtered);
+    free(thiz->hits);
+    free(thiz->hits_base);
+    mpool_free(thiz->mp);
+    mpool_free(thiz->string_mp);
+    free(thiz);
+}
+
+/**
+ * @brief Prints the trie to output in human readable form. It is useful 
+ * for debugging purpose.
+ * 
+ * @param thiz pointer to the trie
+ *****************************************************************************/
+void ac_trie_display (AC_TRIE_t *thiz)
+{
+    ac_trie_traverse_action (thiz->root, node_display, 1);
+}
+
+/**
+ * @brief Gets the patterns of a final node that make a match. If the node has 
+ * patterns with boundary flags, only the patterns that pass the checks are 
+ * taken.
+ * 
+ * @param thiz pointer to the trie
+ * @param node the final node
+ * @param position the end position of the match in the whole input
+ * @param eot indicates that the match is at the end of the input text
+ * @param match receives the match; valid until the next call
+ * @return the number of the matched patterns
+ *****************************************************************************/
+static size_t ac_trie_get_match (AC_TRIE_t *thiz, ACT_NODE_t *node, 
+        size_t position, int eot, AC_MATCH_t *match)
+{
+    size_t j;
+    
+    match->position = position;
+    match->size = node->matched_size;
+    match->patterns = node->matched;
+    
+    if (node->matched_checks)
+    {
+        match->size = 0;
+        match->patterns = thiz->filtered;
+        
+        for (j = 0; j < node->matched_size; j++)
+            if (ac_trie_check_match 
+                    (thiz, &node->matched[j], position, eot))
+                thiz->filtered[match->size++] = node->matched[j];
+    }
+    
+    AC_COUNT (
+        for (j = 0; j < match->size; j++)
+            ac_trie_count_hit (thiz, node, &match->patterns[j]);
+        thiz->counters.matches += match->size);
+    
+    return match->size;
+}
+
+/**
+ * @brief Reports a match to the call-back function. If the node has patterns 
+ * with boundary flags, only the patterns that pass the checks are reported.
+ * 
+ * @param thiz pointer to the trie
+ * @param node the final node
+ * @param position the end position of the match in the whole input
+ * @param eot indicates that the match is at the end of the input text
+ * @param callback
+ * @param user
+ * @return the return value of the call-back, or 0 if nothing is reported
+ *****************************************************************************/
+static int ac_trie_report_match (AC_TRIE_t *thiz, ACT_NODE_t *node, 
+        size_t position, int eot, AC_MATCH_CALBACK_f callback, void *user)
+{
+    AC_MATCH_t match;
+    int ret;
+    
+    if (!ac_trie_get_match (thiz, node, position, eot, &match))
+        return 0;
+    
+    AC_COUNT (thiz->counters.callbacks++;
+        thiz->counters.callback_ns -= ac_trie_clock ());
+    
+    ret = callback (&match, user);
+    
+    AC_COUNT (thiz->counters.callback_ns += ac_trie_clock ());
     
-    return ACERR_SUCCESS;
+    return ret;
 }
 
 /**
- * @brief Finalizes the preprocessing stage and gets the trie ready
+ * @brief Checks if a byte belongs to a word
  * 
- * Locates the failure node for all nodes and collects all matched 
- * pattern for each node. It also sorts outgoing edges of node, so binary 
- * search could be performed on them. After calling this function the automate 
- * will be finalized and you can not add new patterns to the automate.
+ * @param alpha
+ * @return 1 if it is a word byte, 0 otherwise
+ *****************************************************************************/
+static int ac_trie_isword (AC_ALPHABET_t alpha)
+{
+    unsigned char c = (unsigned char) alpha;
+    
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || 
+            (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+/**
+ * @brief Retrieves a byte of the input text by its position in the whole 
+ * input. The byte could be in the given chunk or in the history.
  * 
  * @param thiz pointer to the trie
+ * @param text the chunk; NULL for none
+ * @param offset the position of the chunk in the whole input
+ * @param position the position in the whole input
+ * @param alpha receives the byte
+ * @return 1 if the byte is available, 0 otherwise
  *****************************************************************************/
-void ac_trie_finalize (AC_TRIE_t *thiz)
+static int ac_trie_getchar (AC_TRIE_t *thiz, const AC_TEXT_t *text, 
+        size_t offset, size_t position, AC_ALPHABET_t *alpha)
 {
-    AC_ALPHABET_t prefix[AC_PATTRN_MAX_LENGTH]; 
+    size_t history_base;
     
-    /* 'prefix' defined here, because ac_trie_traverse_setfailure() calls
-     * itself recursively */
-    ac_trie_traverse_setfailure (thiz->root, prefix);
+    if (position >= offset)
+    {
+        position -= offset;
+        
+        if (!text || position >= text->length)
+            return 0;
+        
+        *alpha = text->astring[position];
+        return 1;
+    }
     
-    ac_trie_traverse_action (thiz->root, node_collect_matches, 1);
-    mf_repdata_allocbuf (&thiz->repdata);
+    history_base = offset - thiz->history.length;
     
-    thiz->trie_open = 0; /* Do not accept patterns any more */
+    if (position < history_base)
+        return 0; /* unexpected: the history covers the longest pattern */
+    
+    *alpha = thiz->history.astring[position - history_base];
+    return 1;
 }
 
 /**
- * @brief Search in the input text using the given trie.
+ * @brief Checks the boundary flags of a matched pattern in the current 
+ * chunk of the trie
  * 
  * @param thiz pointer to the trie
- * @param text input text to be searched
- * @param keep indicated that if the input text the successive chunk of the 
- * previous given text or not
- * @param callback when a match occurs this function will be called. The 
- * call-back function in turn after doing its job, will return an integer 
- * value, 0 means continue search, and non-0 value means stop search and return 
- * to the caller.
- * @param user this parameter will be send to the call-back function
- * 
- * @return
- * -1:  failed; trie is not finalized
- *  0:  success; input text was searched to the end
- *  1:  success; input text was searched partially. (callback broke the loop)
+ * @param patt the matched pattern
+ * @param position the end position of the match in the whole input
+ * @param eot indicates that the match is at the end of the input text
+ * @return 1 if the pattern passes the checks, 0 otherwise
  *****************************************************************************/
-int ac_trie_search (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep, 
-        AC_MATCH_CALBACK_f callback, void *user)
+int ac_trie_check_match 
+    (AC_TRIE_t *thiz, AC_PATTERN_t *patt, size_t position, int eot)
 {
-    size_t position;
-    ACT_NODE_t *current;
-    ACT_NODE_t *next;
-    AC_MATCH_t match;
+    return ac_trie_check_text (thiz, patt, thiz->text, thiz->base_position, 
+            position, eot);
+}
 
-    if (thiz->trie_open)
-        return -1;  /* Trie must be finalized first. */
-    
-    if (thiz->wm == AC_WORKING_MODE_FINDNEXT)
-        position = thiz->position;
-    else
-        position = 0;
-    
-    current = thiz->last_node;
+/**
+ * @brief Checks the boundary flags of a matched pattern in the given chunk. 
+ * It only reads the trie: the bytes before the chunk are taken from the 
+ * history, which is not needed when the chunk is the whole input.
+ * 
+ * @param thiz pointer to the trie
+ * @param patt the matched pattern
+ * @param text the chunk
+ * @param offset the position of the chunk in the whole input
+ * @param position the end position of the match in the whole input
+ * @param eot indicates that the match is at the end of the input text
+ * @return 1 if the pattern passes the checks, 0 otherwise
+ *****************************************************************************/
+int ac_trie_check_text (AC_TRIE_t *thiz, AC_PATTERN_t *patt, 
+        const AC_TEXT_t *text, size_t offset, size_t position, int eot)
+{
+    AC_ALPHABET_t alpha;
+    size_t start = position - patt->ptext.length;
+    unsigned int checks = ac_trie_pattern_checks (thiz, patt);
     
-    if (!keep)
-        ac_trie_reset (thiz);
+    if ((checks & AC_PATTFLAG_VERIFY) && 
+            !ac_trie_verify (thiz, patt, text, offset, start))
+        return 0;
     
-    /* This is the main search loop.
-     * It must be kept as lightweight as possible.
-     */
-    while (position < text->length)
+    if ((checks & (AC_PATTFLAG_WORD_START|AC_PATTFLAG_LINE_START)) && 
+            start > 0 && 
+            ac_trie_getchar (thiz, text, offset, start - 1, &alpha))
     {
-        if (!(next = node_find_next_bs (current, text->astring[position])))
-        {
-            if(current->failure_node /* We are not in the root node */)
-                current = current->failure_node;
-            else
-                position++;
-        }
-        else
-        {
-            current = next;
-            position++;
-        }
+        if ((checks & AC_PATTFLAG_WORD_START) && ac_trie_isword (alpha))
+            return 0;
         
-        if (current->final && next)
-        /* We check 'next' to find out if we have come here after a alphabet
-         * transition or due to a fail transition. in second case we should not 
-         * report match, because it has already been reported */
-        {
-            /* Found a match! */
-            match.position = position + thiz->base_position;
-            match.size = current->matched_size;
-            match.patterns = current->matched;
-            
-            /* Do call-back */
-            if (callback(&match, user))
-            {
-                if (thiz->wm == AC_WORKING_MODE_FINDNEXT) {
-                    thiz->position = position;
-                    thiz->last_node = current;
-                }
-                return 1;
-            }
-        }
+        if ((checks & AC_PATTFLAG_LINE_START) && alpha != '\n')
+            return 0;
     }
     
-    /* Save status variables */
-    thiz->last_node = current;
-    thiz->base_position += position;
+    if ((checks & AC_PATTFLAG_LOOKAHEAD) && 
+            !eot && ac_trie_getchar (thiz, text, offset, position, &alpha))
+    {
+        if ((checks & AC_PATTFLAG_WORD_END) && ac_trie_isword (alpha))
+            return 0;
+        
+        if ((checks & AC_PATTFLAG_LINE_END) && 
+                alpha != '\n' && alpha != '\r')
+            return 0;
+    }
     
-    return 0;
+    return 1;
 }
 
 /**
- * @brief sets the input text to be searched by a function call to _findnext()
+ * @brief Finds out the checks that a match of the pattern needs before it 
+ * can be reported
  * 
- * @param thiz The pointer to the trie
- * @param text The text to be searched. The owner of the text is the 
- * calling program and no local copy is made, so it must be valid until you 
- * have done with it.
- * @param keep Indicates that if the given text is the sequel of the previous
- * one or not; 1: it is, 0: it is not
+ * @param thiz pointer to the trie
+ * @param patt the pattern
+ * @return Bitwise OR of the boundary flags and AC_PATTFLAG_VERIFY
  *****************************************************************************/
-void ac_trie_settext (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep)
+unsigned int ac_trie_pattern_checks (AC_TRIE_t *thiz, AC_PATTERN_t *patt)
 {
-    if (!keep)
-        ac_trie_reset (thiz);
+    unsigned int checks = patt->flags & (AC_PATTFLAG_WHOLE_WORD | 
+            AC_PATTFLAG_LINE_START | AC_PATTFLAG_LINE_END);
     
-    thiz->text = text;
-    thiz->position = 0;
+    if (thiz->case_mode == AC_CASE_PER_PATTERN && 
+            !(patt->flags & AC_PATTFLAG_NOCASE))
+        checks |= AC_PATTFLAG_VERIFY;
+    
+    return checks;
 }
 
 /**
- * @brief finds the next match in the input text which is set by _settext()
+ * @brief Compares the matched bytes of the input text with the pattern
  * 
- * @param thiz The pointer to the trie
- * @return A pointer to the matched structure
+ * @param thiz pointer to the trie
+ * @param patt the matched pattern
+ * @param text the chunk
+ * @param offset the position of the chunk in the whole input
+ * @param start the start position of the match in the whole input
+ * @return 1 if they are equal, 0 otherwise
  *****************************************************************************/
-AC_MATCH_t ac_trie_findnext (AC_TRIE_t *thiz)
+static int ac_trie_verify (AC_TRIE_t *thiz, AC_PATTERN_t *patt, 
+        const AC_TEXT_t *text, size_t offset, size_t start)
 {
-    AC_MATCH_t match;
-    
-    thiz->wm = AC_WORKING_MODE_FINDNEXT;
-    match.size = 0;
-    
-    ac_trie_search (thiz, thiz->text, 1, 
-            ac_trie_match_handler, (void *)&match);
+    size_t i;
+    AC_ALPHABET_t alpha, palpha;
+    const AC_ALPHABET_t *map = thiz->map;
     
-    thiz->wm = AC_WORKING_MODE_SEARCH;
+    for (i = 0; i < patt->ptext.length; i++)
+    {
+        if (!ac_trie_getchar (thiz, text, offset, start + i, &alpha))
+            return 0;
+        
+        palpha = patt->ptext.astring[i];
+        
+        if (map)
+        {
+            /* Equivalent bytes are still equal in a case-sensitive match */
+            alpha = map[(unsigned char) alpha];
+            palpha = map[(unsigned char) palpha];
+        }
+        
+        if (alpha != palpha)
+            return 0;
+    }
     
-    return match;
+    return 1;
 }
 
 /**
- * @brief Release all allocated memories to the trie
+ * @brief Builds the translation table from the character mapping and the 
+ * case sensitivity mode
  * 
  * @param thiz pointer to the trie
  *****************************************************************************/
-void ac_trie_release (AC_TRIE_t *thiz)
+static void ac_trie_update_xlat (AC_TRIE_t *thiz)
 {
-    /* It must be called with a 0 top-down parameter */
-    ac_trie_traverse_action (thiz->root, node_release_vectors, 0);
+    size_t i;
+    unsigned char alpha;
+    int fold = (thiz->case_mode != AC_CASE_SENSITIVE);
     
-    mf_repdata_release (&thiz->repdata);
-    mpool_free(thiz->mp);
-    free(thiz);
+    if (!thiz->map)
+    {
+        thiz->xlat = fold ? ac_fold_table : NULL;
+        return;
+    }
+    
+    for (i = 0; i < 256; i++)
+    {
+        alpha = (unsigned char) thiz->map[i];
+        thiz->xlat_table[i] = fold ? 
+                ac_fold_table[alpha] : (AC_ALPHABET_t) alpha;
+    }
+    
+    thiz->xlat = thiz->xlat_table;
 }
 
 /**
- * @brief Prints the trie to output in human readable form. It is useful 
- * for debugging purpose.
+ * @brief Checks if the final node already accepts the pattern, or an 
+ * equivalent of it with the same flags
  * 
  * @param thiz pointer to the trie
+ * @param node the node that the pattern leads to
+ * @param patt the new pattern
+ * @return 1 if the pattern is a duplicate, 0 otherwise
  *****************************************************************************/
-void ac_trie_display (AC_TRIE_t *thiz)
+static int ac_trie_is_duplicate 
+    (AC_TRIE_t *thiz, ACT_NODE_t *node, AC_PATTERN_t *patt)
 {
-    ac_trie_traverse_action (thiz->root, node_display, 1);
+    size_t i;
+    
+    if (!node->final)
+        return 0;
+    
+    if (node_has_pattern (node, patt))
+        return 1;
+    
+    /* Two case-insensitive patterns that lead to the same node are 
+     * equivalent, unless their flags differ */
+    if (ac_trie_pattern_checks (thiz, patt) & AC_PATTFLAG_VERIFY)
+        return 0;
+    
+    for (i = 0; i < node->matched_size; i++)
+        if (node->matched[i].flags == patt->flags && 
+                !(ac_trie_pattern_checks (thiz, &node->matched[i]) & 
+                AC_PATTFLAG_VERIFY))
+            return 1;
+    
+    return 0;
 }
 
 /**
- * @brief the match handler function used in _findnext function
+ * @brief Saves the tail of the input text to the history. 
  * 
- * @param matchp
- * @param param
- * @return 
+ * Only the bytes that a later boundary check may look at are kept: the path 
+ * of the last node plus one byte before it.
+ * 
+ * @param thiz pointer to the trie
+ * @param text the current chunk
+ * @param depth the depth of the node the trie stopped at
  *****************************************************************************/
-static int ac_trie_match_handler (AC_MATCH_t * matchp, void * param)
+void ac_trie_keep_history (AC_TRIE_t *thiz, AC_TEXT_t *text, size_t depth)
 {
-    AC_MATCH_t * mp = (AC_MATCH_t *)param;
-    mp->position = matchp->position;
-    mp->patterns = matchp->patterns;
-    mp->size = matchp->size;
-    return 1;
+    AC_ALPHABET_t *history = (AC_ALPHABET_t *) thiz->history.astring;
+    size_t needed = depth + 1;
+    size_t from_text, from_history;
+    
+    if (!history)
+        return; /* No pattern needs the history */
+    
+    if (needed > text->length + thiz->history.length)
+        needed = text->length + thiz->history.length;
+    
+    from_text = (needed < text->length) ? needed : text->length;
+    from_history = needed - from_text;
+    
+    memmove (history, &history[thiz->history.length - from_history], 
+            from_history * sizeof(AC_ALPHABET_t));
+    memcpy (&history[from_history], &text->astring[text->length - from_text], 
+            from_text * sizeof(AC_ALPHABET_t));
+    
+    thiz->history.length = needed;
 }
 
 /**
@@ -327,13 +1544,38 @@ static int ac_trie_match_handler (AC_MATCH_t * matchp, void * param)
  * 
  * @param thiz pointer to the trie
  *****************************************************************************/
-static void ac_trie_reset (AC_TRIE_t *thiz)
+void ac_trie_reset (AC_TRIE_t *thiz)
 {
     thiz->last_node = thiz->root;
     thiz->base_position = 0;
+    thiz->history.length = 0;
+    thiz->pending_node = NULL;
     mf_repdata_reset (&thiz->repdata);
 }
 
+/**
+ * @brief Finds the maximum number of matched patterns in a node
+ * 
+ * @param node the root node
+ * @return 
+ *****************************************************************************/
+static size_t ac_trie_max_matched (ACT_NODE_t *node)
+{
+    size_t i, max, n;
+    
+    max = node->matched_size;
+    
+    for (i = 0; i < node->outgoing_size; i++)
+    {
+        /* Recursively call itself to traverse all nodes */
+        n = ac_trie_max_matched (node->outgoing[i].next);
+        if (n > max)
+            max = n;
+    }
+    
+    return max;
+}
+
 /**
  * @brief Finds and bookmarks the failure transition for the given node.
  * 
@@ -420,3 +1662,200 @@ static void ac_trie_traverse_action
     if (!top_down)
         func (node);
 }
+
+/**
+ * @brief Counts the nodes of the sub-trie
+ * 
+ * @param node the root of the sub-trie
+ * @return 
+ *****************************************************************************/
+static size_t ac_trie_count_nodes (ACT_NODE_t *node)
+{
+    size_t i, count = 1;
+    
+    for (i = 0; i < node->outgoing_size; i++)
+        count += ac_trie_count_nodes (node->outgoing[i].next);
+    
+    return count;
+}
+
+/**
+ * @brief Numbers the nodes in breadth-first order and builds the node index
+ * 
+ * After this, the id of the root is 0 and the id of every node is its index
+ * in thiz->nodes, so a state of the automaton can be kept as a plain number.
+ * 
+ * @param thiz pointer to the trie
+ *****************************************************************************/
+static void ac_trie_number_nodes (AC_TRIE_t *thiz)
+{
+    ACT_NODE_t *node;
+    size_t head, tail, i;
+    
+    thiz->nodes_count = ac_trie_count_nodes (thiz->root);
+    thiz->nodes = (ACT_NODE_t **) 
+            malloc (thiz->nodes_count * sizeof(ACT_NODE_t *));
+    thiz->vectors_size += thiz->nodes_count * sizeof(ACT_NODE_t *);
+    
+    /* The index itself is the queue of the traversal */
+    thiz->nodes[0] = thiz->root;
+    
+    for (head = 0, tail = 1; head < tail; head++)
+    {
+        node = thiz->nodes[head];
+        node->id = (int) head;
+        
+        for (i = 0; i < node->outgoing_size; i++)
+            thiz->nodes[tail++] = node->outgoing[i].next;
+    }
+}
+
+/**
+ * @brief Builds the tables of the root children used by the prefetch
+ * 
+ * @param thiz pointer to the trie
+ *****************************************************************************/
+static void ac_trie_build_lookahead (AC_TRIE_t *thiz)
+{
+    ACT_NODE_t *next;
+    AC_ALPHABET_t alpha;
+    unsigned int i;
+    
+    for (i = 0; i < 256; i++)
+    {
+        alpha = thiz->xlat ? thiz->xlat[i] : (AC_ALPHABET_t) i;
+        next = node_find_next_bs (thiz->root, alpha);
+        
+        thiz->root_next[i] = next;
+        thiz->root_edges[i] = next ? next->outgoing : NULL;
+    }
+}
+
+/**
+ * @brief Finds the memory size of the automaton: the nodes, their vectors 
+ * and the pattern strings
+ * 
+ * @param thiz pointer to the trie
+ * @return the size in bytes
+ *****************************************************************************/
+static size_t ac_trie_automaton_size (AC_TRIE_t *thiz)
+{
+    size_t i, bytes;
+    
+    bytes = mpool_size (thiz->mp) + mpool_size (thiz->string_mp);
+    
+    if (thiz->frozen)
+        return bytes; /* Everything is in the pools */
+    
+    bytes += thiz->nodes_count * sizeof(ACT_NODE_t *);
+    
+    for (i = 0; i < thiz->nodes_count; i++)
+        bytes += thiz->nodes[i]->outgoing_capacity * sizeof(struct act_edge)
+                + thiz->nodes[i]->matched_capacity * sizeof(AC_PATTERN_t);
+    
+    return bytes;
+}
+
+/**
+ * @brief Estimates the memory that adding a pattern takes at most: an edge 
+ * per byte, a pattern vector entry, and the new pool blocks if the nodes 
+ * (one per byte) or the copied strings do not fit in the current ones
+ * 
+ * @param thiz pointer to the trie
+ * @param patt pointer to the pattern
+ * @param copy whether the strings of the pattern are copied
+ * @return the size in bytes
+ *****************************************************************************/
+static size_t ac_trie_pattern_size 
+    (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy)
+{
+    size_t bytes, strings;
+    
+    bytes = patt->ptext.length * sizeof(struct act_edge) + sizeof(AC_PATTERN_t);
+    
+    bytes += mpool_growth (thiz->mp, 
+            patt->ptext.length * ((sizeof(ACT_NODE_t) + 15) & ~0xF));
+    
+    if (copy)
+    {
+        strings = patt->ptext.length + patt->rtext.length + 2 + 32;
+        if (patt->id.type == AC_PATTID_TYPE_STRING && patt->id.u.stringy)
+            strings += strlen (patt->id.u.stringy) + 1 + 16;
+        
+        bytes += mpool_growth (thiz->string_mp, strings);
+    }
+    
+    return bytes;
+}
+
+#ifdef AC_COUNTERS
+/**
+ * @brief Numbers the patterns for the hit counters
+ * 
+ * The own patterns of a node are those as long as the node's depth; they 
+ * precede the patterns that are collected from the failure nodes. The 
+ * patterns are numbered in the order of the node ids.
+ * 
+ * @param thiz pointer to the trie
+ *****************************************************************************/
+static void ac_trie_number_patterns (AC_TRIE_t *thiz)
+{
+    ACT_NODE_t *node;
+    size_t i, j, number = 0;
+    
+    thiz->hits = (size_t *) calloc (thiz->patterns_count, sizeof(size_t));
+    thiz->hits_base = (size_t *) malloc (thiz->nodes_count * sizeof(size_t));
+    thiz->vectors_size += 
+            (thiz->patterns_count + thiz->nodes_count) * sizeof(size_t);
+    
+    for (i = 0; i < thiz->nodes_count; i++)
+    {
+        node = thiz->nodes[i];
+        thiz->hits_base[i] = number;
+        
+        for (j = 0; j < node->matched_size && 
+                node->matched[j].ptext.length == node->depth; j++)
+            number++;
+    }
+}
+
+/**
+ * @brief Counts a hit of a pattern
+ * 
+ * @param thiz pointer to the trie
+ * @param node the node at which the pattern matched
+ * @param patt the matched pattern; a copy of a pattern of the node
+ *****************************************************************************/
+void ac_trie_count_hit (AC_TRIE_t *thiz, ACT_NODE_t *node, AC_PATTERN_t *patt)
+{
+    size_t j;
+    
+    /* Find the node that owns the pattern on the failure chain */
+    while (node->depth > patt->ptext.length && node->failure_node)
+        node = node->failure_node;
+    
+    for (j = 0; j < node->matched_size; j++)
+        if (node->matched[j].ptext.astring == patt->ptext.astring && 
+                node->matched[j].flags == patt->flags)
+            break;
+    
+    if (j == node->matched_size)
+        return; /* Not a pattern of the trie; there is no slot to charge */
+    
+    thiz->hits[thiz->hits_base[node->id] + j]++;
+}
+
+/**
+ * @brief Reads the monotonic clock for the call-back timing
+ * 
+ * @return the time in nanoseconds
+ *****************************************************************************/
+unsigned long long ac_trie_clock (void)
+{
+    struct timespec ts;
+    
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
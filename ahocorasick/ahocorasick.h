@@ -22,6 +22,8 @@
 #define _AHOCORASICK_H_
 
 #include "replace.h"
+#include "scanner.h"
+#include "stream.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,7 +31,76 @@ extern "C" {
 
 /* Forward declaration */
 struct act_node;
+struct act_edge;
 struct mpool;
+struct ac_prefilter;
+
+/**
+ * Number of the buckets of the failure chain length histogram; the last 
+ * bucket counts all the longer chains
+ */
+#define AC_STATS_CHAIN_BUCKETS 32
+
+/*
+ * The runtime counters of the search and replace loops. They are only 
+ * updated when the library is built with AC_COUNTERS defined, e.g. 
+ * make CFLAGS="-Wall -DAC_COUNTERS". All the counters are cumulative.
+ */
+typedef struct ac_counters
+{
+    size_t bytes;       /**< Input bytes scanned, including the skipped ones */
+    size_t skipped;     /**< Input bytes skipped by the prefilter */
+    size_t gotos;       /**< Transitions along the edges */
+    size_t failures;    /**< Transitions to the failure nodes */
+    size_t matches;     /**< Patterns reported to the user (search), or 
+                         * booked for replacement (replace) */
+    size_t callbacks;   /**< Calls to the user call-back functions */
+    unsigned long long callback_ns; /**< Time spent in the call-backs in 
+                                     * nanoseconds */
+} AC_COUNTERS_t;
+
+/*
+ * The number of the hits of a pattern
+ */
+typedef struct ac_pattern_hits
+{
+    AC_PATTERN_t *pattern;  /**< The pattern, as it is kept in the trie */
+    size_t hits;            /**< Number of times it was matched */
+} AC_PATTERN_HITS_t;
+
+/*
+ * The statistics of a finalized trie
+ */
+typedef struct ac_trie_stats
+{
+    size_t nodes_count;     /**< Number of nodes, including the root */
+    size_t edges_count;     /**< Number of edges */
+    size_t final_count;     /**< Number of the nodes which match a pattern */
+    size_t matched_count;   /**< Total entries of the matched pattern vectors, 
+                             * including those collected from failure nodes */
+    
+    size_t max_depth;       /**< Depth of the deepest node */
+    double avg_depth;       /**< Average depth of the nodes */
+    
+    size_t fanout[257];     /**< Number of the nodes by their number of 
+                             * outgoing edges */
+    
+    size_t chain[AC_STATS_CHAIN_BUCKETS]; /**< Number of the nodes by the 
+                                           * number of failure transitions 
+                                           * that take them to the root */
+    size_t max_chain;       /**< The longest failure chain */
+    double avg_chain;       /**< Average failure chain length */
+    
+    size_t memory_nodes;    /**< Bytes of the nodes */
+    size_t memory_edges;    /**< Bytes of the edge vectors */
+    size_t memory_matched;  /**< Bytes of the matched pattern vectors */
+    size_t memory_strings;  /**< Bytes of the pattern string pool */
+    size_t memory_other;    /**< Bytes of the rest: the node index, the 
+                             * prefilter, the buffers and the unused parts 
+                             * of the memory pool */
+    size_t memory_total;    /**< Total bytes; same as ac_trie_memory() */
+    
+} AC_TRIE_STATS_t;
 
 /* 
  * The A.C. Trie data structure 
@@ -38,16 +109,67 @@ typedef struct ac_trie
 {
     struct act_node *root;      /**< The root node of the trie */
     
+    struct act_node **nodes;    /**< All the nodes indexed by their id; 
+                                 * available after finalize */
+    size_t nodes_count;         /**< Total nodes in the trie */
+    
     size_t patterns_count;      /**< Total patterns in the trie */
+    unsigned int patterns_checks; /**< Bitwise OR of the checks of all the 
+                                   * patterns */
+    
+    AC_CASE_MODE_t case_mode;   /**< Case sensitivity of the patterns */
+    
+    const AC_ALPHABET_t *map;   /**< User character mapping; NULL for none */
+    const AC_ALPHABET_t *xlat;  /**< Translation table which is applied to 
+                                 * the pattern and input bytes before they 
+                                 * enter the automaton: the user mapping 
+                                 * followed by case folding; NULL for none */
+    
+    AC_ALPHABET_t map_table[256];   /**< Holds the copy of the user mapping */
+    AC_ALPHABET_t xlat_table[256];  /**< Holds the translation table */
+    
+    AC_ENGINE_t engine; /**< The requested search engine; after finalize, 
+                         * the engine in use */
+    
+    struct ac_prefilter *prefilter; /**< Skips the input bytes that can not 
+                                     * take the automaton out of the root 
+                                     * node; NULL if not used */
+    
+    size_t prefetch;    /**< Lookahead distance of the software prefetch in 
+                         * the search loop; 0 means disabled */
+    
+    struct act_node *root_next[256];    /**< The child of the root for each 
+                                         * input byte; NULL for none */
+    struct act_edge *root_edges[256];   /**< The edges of these children */
     
     short trie_open; /**< This flag indicates that if trie is finalized 
                           * or not. After finalizing the trie you can not 
                           * add pattern to trie anymore. */
     
-    struct mpool *mp;   /**< Memory pool */
+    struct mpool *mp;   /**< Memory pool of the nodes */
+    struct mpool *string_mp;    /**< Memory pool of the pattern strings */
+    
+    short frozen;   /**< Indicates that the automaton is compacted by 
+                     * ac_trie_freeze() */
+    size_t freeze_before;   /**< Size of the automaton in bytes before it was 
+                             * compacted */
+    size_t freeze_after;    /**< Size of the automaton in bytes after it was 
+                             * compacted */
+    
+    size_t vectors_size;    /**< Bytes of the malloc'd memory of the trie: 
+                             * the edge and pattern vectors of the nodes, the 
+                             * node index and the search and replacement 
+                             * buffers */
+    size_t memory_budget;   /**< Maximum memory of the trie in bytes; 0 for 
+                             * no limit */
     
     /* ******************* Thread specific part ******************** */
     
+    AC_COUNTERS_t counters; /**< Runtime counters; see AC_COUNTERS_t */
+    size_t *hits;           /**< Hits of each pattern, by pattern number */
+    size_t *hits_base;      /**< Number of the first pattern of each node, by 
+                             * node id */
+    
     /* It is possible to search a long input chunk by chunk. In order to
      * connect these chunks and make a continuous view of the input, we need 
      * the following variables.
@@ -60,10 +182,25 @@ typedef struct ac_trie
     size_t position;    /**< A helper variable to hold the relative current 
                          * position in the given text */
     
+    AC_MATCH_t match;   /**< The current match of ac_trie_findnext() */
+    size_t match_index; /**< The next pattern of the current match */
+    short text_done;    /**< The text of ac_trie_settext() is searched to the 
+                         * end */
+    
+    AC_TEXT_t history;  /**< The tail of the previous chunks. Only kept if 
+                         * some patterns have boundary flags, which need to 
+                         * look at the bytes before a match that started in 
+                         * a previous chunk. */
+    
+    struct act_node *pending_node; /**< The final node reached at the end of 
+                                    * the previous chunk whose match is held 
+                                    * back until the next byte is known */
+    
+    AC_PATTERN_t *filtered; /**< A helper array to hold the patterns of a 
+                             * match that pass the boundary checks */
+    
     MF_REPLACEMENT_DATA_t repdata;    /**< Replacement data structure */
     
-    ACT_WORKING_MODE_t wm; /**< Working mode */
-        
 } AC_TRIE_t;
 
 /* 
@@ -71,21 +208,61 @@ typedef struct ac_trie
  */
 
 AC_TRIE_t *ac_trie_create (void);
+AC_STATUS_t ac_trie_setcase (AC_TRIE_t *thiz, AC_CASE_MODE_t mode);
+AC_STATUS_t ac_trie_setmap (AC_TRIE_t *thiz, const AC_ALPHABET_t *map);
+AC_STATUS_t ac_trie_setengine (AC_TRIE_t *thiz, AC_ENGINE_t engine);
+void ac_trie_setprefetch (AC_TRIE_t *thiz, size_t distance);
+void ac_trie_setpoolcache (size_t count);
+AC_STATUS_t ac_trie_setpages (AC_TRIE_t *thiz, AC_PAGES_t mode);
+size_t ac_trie_hugepages (AC_TRIE_t *thiz);
+void ac_trie_setbudget (AC_TRIE_t *thiz, size_t bytes);
+AC_STATUS_t ac_trie_setbuffer (AC_TRIE_t *thiz, size_t size);
+size_t ac_trie_memory (AC_TRIE_t *thiz);
+AC_STATUS_t ac_trie_stats (AC_TRIE_t *thiz, AC_TRIE_STATS_t *stats);
+AC_STATUS_t ac_trie_counters (AC_TRIE_t *thiz, 
+        AC_COUNTERS_t *counters, AC_PATTERN_HITS_t *hits);
 AC_STATUS_t ac_trie_add (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy);
+AC_STATUS_t ac_trie_add_flags (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy);
 void ac_trie_finalize (AC_TRIE_t *thiz);
+AC_STATUS_t ac_trie_freeze (AC_TRIE_t *thiz);
 void ac_trie_release (AC_TRIE_t *thiz);
 void ac_trie_display (AC_TRIE_t *thiz);
 
 int  ac_trie_search (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep, 
         AC_MATCH_CALBACK_f callback, void *param);
+int  ac_trie_search_flush (AC_TRIE_t *thiz, 
+        AC_MATCH_CALBACK_f callback, void *param);
 
 void ac_trie_settext (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep);
 AC_MATCH_t ac_trie_findnext (AC_TRIE_t *thiz);
+AC_MATCH_t ac_trie_next (AC_TRIE_t *thiz);
+
+size_t ac_trie_stream_size (AC_TRIE_t *thiz);
+AC_STATUS_t ac_trie_stream_save (AC_TRIE_t *thiz, void *buffer, size_t *size);
+AC_STATUS_t ac_trie_stream_load (AC_TRIE_t *thiz, const void *buffer, 
+        size_t size);
 
 int  multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *text, 
         MF_REPLACE_MODE_t mode, MF_REPLACE_CALBACK_f callback, void *param);
+int  multifast_replacev (AC_TRIE_t *thiz, AC_TEXT_t *text, 
+        MF_REPLACE_MODE_t mode, MF_REPLACE_SEGMENTS_CALBACK_f callback, 
+        void *param);
+int  multifast_replace_tobuffer (AC_TRIE_t *thiz, AC_TEXT_t *text, 
+        MF_REPLACE_MODE_t mode, MF_OUTPUT_t *output);
+int  multifast_replace_inplace (AC_TRIE_t *thiz, AC_TEXT_t *text);
+int  multifast_replace_parallel (AC_TRIE_t *thiz, AC_TEXT_t *text, 
+        MF_REPLACE_MODE_t mode, unsigned int threads, 
+        MF_REPLACE_SEGMENTS_CALBACK_f callback, void *param);
 void multifast_rep_flush (AC_TRIE_t *thiz, int keep);
 
+/* ac_trie_scan() returns 0 when all the chunks are scanned, 1 when the 
+ * call-back stopped it, -1 if the trie is not finalized, and -2 if the trie 
+ * has patterns that need checks (boundary flags, or case sensitive patterns 
+ * in the AC_CASE_PER_PATTERN mode), which it does not support; use 
+ * ac_trie_search() for those */
+int  ac_trie_scan (AC_TRIE_t *thiz, AC_SCANNER_t *scanners, size_t count, 
+        AC_MATCH_CALBACK_f callback);
+
 
 #ifdef __cplusplus
 }
@@ -1,197 +1,693 @@
-/*
- * mpool.c memory pool management
- * This file is part of multifast.
- *
-    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
-
-    multifast is free software: you can redistribute it and/or modify
-    it under the terms of the GNU Lesser General Public License as published by
-    the Free Software Foundation, either version 3 of the License, or
-    (at your option) any later version.
-
-    multifast is distributed in the hope that it will be useful,
-    but WITHOUT ANY WARRANTY; without even the implied warranty of
-    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-    GNU Lesser General Public License for more details.
-
-    You should have received a copy of the GNU Lesser General Public License
-    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
-*/
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include "mpool.h"
-
-
-#define MPOOL_BLOCK_SIZE (24*1024)
-
-#if (MPOOL_BLOCK_SIZE % 16 > 0)
-#error "MPOOL_BLOCK_SIZE must be multiple 16"
-#endif
-
-#if (MPOOL_BLOCK_SIZE <= AC_PATTRN_MAX_LENGTH)
-#error "MPOOL_BLOCK_SIZE must be bigger than AC_PATTRN_MAX_LENGTH"
-#endif
-
-struct mpool_block
-{
-    size_t size;
-    unsigned char *bp;      /* Block pointer */
-    unsigned char *free;    /* Free area; End of allocated section */
-    
-    struct mpool_block *next; /* Next block */
-};
-
-struct mpool 
-{
-    struct mpool_block *block;
-};
-
-
-/**
- * @brief Allocate a new block to the pool
- * 
- * @param size
- * @return 
-******************************************************************************/
-static struct mpool_block *mpool_new_block (size_t size) 
-{
-    struct mpool_block *block;
-    
-    if (!size) 
-        size = MPOOL_BLOCK_SIZE;
-    
-    block = (struct mpool_block *) malloc (sizeof(struct mpool_block));
-    
-    block->bp = block->free = malloc(size);
-    block->size = size;
-    block->next = NULL;
-    
-    return block;
-}
-
-/**
- * @brief Creates a new pool
- * 
- * @param size
- * @return 
-******************************************************************************/
-struct mpool *mpool_create (size_t size) 
-{
-    struct mpool *ret;
-    
-    ret = malloc (sizeof(struct mpool));
-    ret->block = mpool_new_block(size);
-    
-    return ret;
-}
-
-/**
- * @brief Free a pool
- * 
- * @param pool
-******************************************************************************/
-void mpool_free (struct mpool *pool) 
-{
-    struct mpool_block *p, *p_next;
-    
-    if (!pool)
-        return;
-    
-    if (!pool->block) {
-        free(pool);
-	return;
-    }
-    
-    p = pool->block;
-    
-    while (p) {
-	p_next = p->next;
-	free(p->bp);
-	free(p);
-	p = p_next;
-    }
-    
-    free(pool);
-}
-
-/**
- * @brief Allocate from a pool
- * 
- * @param pool
- * @param size
- * @return 
-******************************************************************************/
-void *mpool_malloc (struct mpool *pool, size_t size) 
-{
-    void *ret = NULL;
-    struct mpool_block *block, *new_block;
-    size_t remain, block_size;
-    
-    if(!pool || !pool->block || !size)
-	return NULL;
-    
-    size = (size + 15) & ~0xF; /* This is to align memory allocation on 
-                                * multiple 16 boundary */
-    
-    block = pool->block;
-    remain = block->size - ((size_t)block->free - (size_t)block->bp);
-    
-    if (remain < size) 
-    {
-        /* Allocate a new block */
-        block_size = ((size > block->size) ? size : block->size);
-	new_block = mpool_new_block (block_size);
-	new_block->next = block;
-	block = pool->block = new_block;
-    }
-    
-    ret = block->free;
-    
-    block->free = block->bp + (block->free - block->bp + size);
-    
-    return ret;
-}
-
-/**
- * @brief Makes a copy of a string with known size
- * 
- * @param pool
- * @param str
- * @param n
- * @return 
- *****************************************************************************/
-void *mpool_strndup (struct mpool *pool, const char *str, size_t n) 
-{
-    void *ret;
-    
-    if (!str)
-        return NULL;
-    
-    if ((ret = mpool_malloc(pool, n+1)))
-    {
-        strncpy((char *)ret, str, n);
-        ((char *)ret)[n] = '\0';
-    }
-    
-    return ret;
-}
-
-/**
- * @brief Makes a copy of zero terminated string
- * 
- * @param pool
- * @param str
- * @return 
-******************************************************************************/
-void *mpool_strdup (struct mpool *pool, const char *str) 
-{
-    size_t len;
-    
-    if (!str) 
-        return NULL;
-    len = strlen(str);
-    
-    return mpool_strndup (pool, str, len);
-}
+/*
+ * mpool.c memory pool management
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpool.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#define MPOOL_MMAP
+#endif
+
+
+#define MPOOL_BLOCK_SIZE (24*1024)
+
+/* The blocks grow geometrically up to this size */
+#define MPOOL_BLOCK_MAX_SIZE (2*1024*1024)
+
+/* Maximum number of pools in the cache of a thread */
+#define MPOOL_CACHE_MAX 16
+
+#if defined(__GNUC__)
+#define MPOOL_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define MPOOL_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define MPOOL_THREAD_LOCAL _Thread_local
+#endif
+
+/* On POSIX systems a thread-specific key drains the cache at thread exit */
+#if defined(MPOOL_THREAD_LOCAL) && !defined(_WIN32)
+#include <pthread.h>
+#define MPOOL_CACHE_DESTRUCTOR
+#endif
+
+#if (MPOOL_BLOCK_SIZE % 16 > 0)
+#error "MPOOL_BLOCK_SIZE must be multiple 16"
+#endif
+
+#if (MPOOL_BLOCK_SIZE <= AC_PATTRN_MAX_LENGTH)
+#error "MPOOL_BLOCK_SIZE must be bigger than AC_PATTRN_MAX_LENGTH"
+#endif
+
+struct mpool_block
+{
+    size_t size;
+    unsigned char *bp;      /* Block pointer */
+    unsigned char *free;    /* Free area; End of allocated section */
+    
+    enum mpool_pages pages; /* How the block was allocated */
+    
+    struct mpool_block *next; /* Next block */
+};
+
+struct mpool 
+{
+    struct mpool_block *block;
+    struct mpool_block *spare;  /* Rewound blocks to be used again */
+    enum mpool_pages pages; /* Page mode of the new blocks */
+    int sized;              /* Created with a given size; not cached */
+    struct mpool *next;     /* Next pool in the cache */
+};
+
+#ifdef MPOOL_THREAD_LOCAL
+/* The released pools which are kept by the thread for reuse */
+static MPOOL_THREAD_LOCAL struct mpool *mpool_cache = NULL;
+static MPOOL_THREAD_LOCAL size_t mpool_cache_size = 0;
+static MPOOL_THREAD_LOCAL size_t mpool_cache_max = 0;
+#endif
+
+#ifdef MPOOL_CACHE_DESTRUCTOR
+static pthread_key_t mpool_cache_key;
+static pthread_once_t mpool_cache_once = PTHREAD_ONCE_INIT;
+static int mpool_cache_keyed = 0;
+#endif
+
+static unsigned char *mpool_map (size_t size, enum mpool_pages *pages);
+static void mpool_unmap (struct mpool_block *block);
+static void mpool_free_blocks (struct mpool_block *block);
+static void mpool_destroy (struct mpool *pool);
+static size_t mpool_next_block_size (struct mpool_block *block, size_t size);
+#ifdef MPOOL_CACHE_DESTRUCTOR
+static void mpool_cache_makekey (void);
+static void mpool_cache_destructor (void *value);
+#endif
+
+
+/**
+ * @brief Allocate a new block to the pool
+ * 
+ * @param size
+ * @return 
+******************************************************************************/
+static struct mpool_block *mpool_new_block 
+    (size_t size, enum mpool_pages pages) 
+{
+    struct mpool_block *block;
+    
+    if (!size) 
+        size = MPOOL_BLOCK_SIZE;
+    
+    block = (struct mpool_block *) malloc (sizeof(struct mpool_block));
+    
+    if (pages != MPOOL_PAGES_DEFAULT)
+    {
+        /* Huge page blocks are made of whole huge pages */
+        size = (size + MPOOL_HUGE_PAGE_SIZE - 1) & 
+                ~((size_t) MPOOL_HUGE_PAGE_SIZE - 1);
+        
+        block->bp = mpool_map (size, &pages);
+    }
+    
+    if (pages == MPOOL_PAGES_DEFAULT)
+        block->bp = malloc(size);
+    
+    block->free = block->bp;
+    block->size = size;
+    block->pages = pages;
+    block->next = NULL;
+    
+    return block;
+}
+
+/**
+ * @brief Maps a huge page block
+ * 
+ * @param size the size of the block; a multiple of MPOOL_HUGE_PAGE_SIZE
+ * @param pages the requested page mode; receives the mode that was actually 
+ * used, which is MPOOL_PAGES_DEFAULT if mapping failed
+ * @return the block, or NULL if mapping failed
+******************************************************************************/
+static unsigned char *mpool_map (size_t size, enum mpool_pages *pages)
+{
+#ifdef MPOOL_MMAP
+    unsigned char *p, *aligned;
+    size_t head;
+    
+#ifdef MAP_HUGETLB
+    if (*pages == MPOOL_PAGES_HUGETLB)
+    {
+        p = mmap (NULL, size, PROT_READ | PROT_WRITE, 
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        
+        if (p != MAP_FAILED)
+            return p;
+    }
+#endif
+    
+    /* Map one page more, so that the block can be aligned on a huge page */
+    p = mmap (NULL, size + MPOOL_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    
+    if (p == MAP_FAILED)
+    {
+        *pages = MPOOL_PAGES_DEFAULT;
+        return NULL;
+    }
+    
+    aligned = (unsigned char *) (((size_t) p + MPOOL_HUGE_PAGE_SIZE - 1) & 
+            ~((size_t) MPOOL_HUGE_PAGE_SIZE - 1));
+    head = aligned - p;
+    
+    if (head)
+        munmap (p, head);
+    munmap (aligned + size, MPOOL_HUGE_PAGE_SIZE - head);
+    
+#ifdef MADV_HUGEPAGE
+    madvise (aligned, size, MADV_HUGEPAGE);
+#endif
+    
+    *pages = MPOOL_PAGES_HUGE;
+    return aligned;
+#else
+    *pages = MPOOL_PAGES_DEFAULT;
+    return NULL;
+#endif
+}
+
+/**
+ * @brief Unmaps a huge page block
+ * 
+ * @param block
+******************************************************************************/
+static void mpool_unmap (struct mpool_block *block)
+{
+#ifdef MPOOL_MMAP
+    munmap (block->bp, block->size);
+#endif
+}
+
+/**
+ * @brief Creates a new pool
+ * 
+ * @param size the size of the first block; 0 for the default
+ * @param pages the page mode of the blocks
+ * @return 
+******************************************************************************/
+struct mpool *mpool_create (size_t size, enum mpool_pages pages) 
+{
+    struct mpool *ret;
+    
+#ifdef MPOOL_THREAD_LOCAL
+    struct mpool **pp;
+    
+    /* A pool of the default size can be taken from the cache */
+    if (!size)
+    {
+        for (pp = &mpool_cache; *pp; pp = &(*pp)->next)
+        {
+            if ((*pp)->pages == pages)
+            {
+                ret = *pp;
+                *pp = ret->next;
+                ret->next = NULL;
+                mpool_cache_size--;
+                return ret;
+            }
+        }
+    }
+#endif
+    
+    ret = malloc (sizeof(struct mpool));
+    ret->pages = pages;
+    ret->sized = (size != 0);
+    ret->block = mpool_new_block(size, ret->pages);
+    ret->spare = NULL;
+    ret->next = NULL;
+    
+    return ret;
+}
+
+/**
+ * @brief Free a pool
+ * 
+ * If the thread keeps a cache of pools and the cache is not full, a pool of 
+ * the default size is rewound and kept in the cache instead. Pools that 
+ * were created with a given size, or have grown a block beyond 
+ * MPOOL_BLOCK_MAX_SIZE, are always released, so that the cache does not pin 
+ * large blocks.
+ * 
+ * @param pool
+******************************************************************************/
+void mpool_free (struct mpool *pool) 
+{
+#ifdef MPOOL_THREAD_LOCAL
+    struct mpool_block *p;
+    int cacheable;
+#endif
+    
+    if (!pool)
+        return;
+    
+#ifdef MPOOL_THREAD_LOCAL
+    cacheable = (pool->block && !pool->sized && 
+            mpool_cache_size < mpool_cache_max);
+    
+    for (p = pool->block; p && cacheable; p = p->next)
+        if (p->size > MPOOL_BLOCK_MAX_SIZE)
+            cacheable = 0;
+    
+    for (p = pool->spare; p && cacheable; p = p->next)
+        if (p->size > MPOOL_BLOCK_MAX_SIZE)
+            cacheable = 0;
+    
+    if (cacheable)
+    {
+        mpool_reset (pool);
+        pool->next = mpool_cache;
+        mpool_cache = pool;
+        mpool_cache_size++;
+        return;
+    }
+#endif
+    
+    mpool_destroy (pool);
+}
+
+/**
+ * @brief Releases a pool and all of its blocks
+ * 
+ * @param pool
+******************************************************************************/
+static void mpool_destroy (struct mpool *pool) 
+{
+    mpool_free_blocks (pool->block);
+    mpool_free_blocks (pool->spare);
+    free(pool);
+}
+
+/**
+ * @brief Releases a list of blocks
+ * 
+ * @param block the first block of the list
+******************************************************************************/
+static void mpool_free_blocks (struct mpool_block *block) 
+{
+    struct mpool_block *p, *p_next;
+    
+    p = block;
+    
+    while (p) {
+	p_next = p->next;
+	if (p->pages == MPOOL_PAGES_DEFAULT)
+	    free(p->bp);
+	else
+	    mpool_unmap(p);
+	free(p);
+	p = p_next;
+    }
+}
+
+/**
+ * @brief Rewinds a pool
+ * 
+ * All the allocations from the pool are dropped at once, but the blocks 
+ * are kept and are handed out again by the next allocations.
+ * 
+ * @param pool
+******************************************************************************/
+void mpool_reset (struct mpool *pool) 
+{
+    struct mpool_block *p, *p_next;
+    
+    if (!pool || !pool->block)
+        return;
+    
+    /* Move all the blocks but the current one to the spare list */
+    p = pool->block->next;
+    pool->block->next = NULL;
+    pool->block->free = pool->block->bp;
+    
+    while (p) {
+        p_next = p->next;
+        p->free = p->bp;
+        p->next = pool->spare;
+        pool->spare = p;
+        p = p_next;
+    }
+}
+
+/**
+ * @brief Sets the number of released pools that the calling thread keeps 
+ * for reuse
+ * 
+ * The pools of the default size are cached: mpool_free() keeps them, and 
+ * mpool_create() hands them out again with their blocks. The cache is 
+ * disabled by default. Setting the count to 0 releases the cached pools. 
+ * On POSIX systems this is also done when the thread exits; elsewhere the 
+ * thread must set the count to 0 before it exits, or the cached pools leak. 
+ * A pool goes to the cache of the thread which frees it, not the one which 
+ * created it. Where thread-local storage is not available, this function 
+ * does nothing.
+ * 
+ * @param count maximum number of the cached pools
+******************************************************************************/
+void mpool_setcache (size_t count) 
+{
+#ifdef MPOOL_THREAD_LOCAL
+    struct mpool *pool;
+    
+    if (count > MPOOL_CACHE_MAX)
+        count = MPOOL_CACHE_MAX;
+    
+#ifdef MPOOL_CACHE_DESTRUCTOR
+    /* A non-NULL value makes the key destructor run when the thread exits */
+    if (count && !mpool_cache_max)
+    {
+        pthread_once (&mpool_cache_once, mpool_cache_makekey);
+        if (mpool_cache_keyed)
+            pthread_setspecific (mpool_cache_key, &mpool_cache_key);
+    }
+#endif
+    
+    mpool_cache_max = count;
+    
+    while (mpool_cache_size > mpool_cache_max)
+    {
+        pool = mpool_cache;
+        mpool_cache = pool->next;
+        mpool_cache_size--;
+        mpool_destroy (pool);
+    }
+#endif
+}
+
+#ifdef MPOOL_CACHE_DESTRUCTOR
+/**
+ * @brief Creates the key whose destructor drains the cache of exiting threads
+******************************************************************************/
+static void mpool_cache_makekey (void) 
+{
+    mpool_cache_keyed = (pthread_key_create (&mpool_cache_key, 
+            mpool_cache_destructor) == 0);
+}
+
+/**
+ * @brief Releases the cached pools of an exiting thread
+ * 
+ * @param value unused
+******************************************************************************/
+static void mpool_cache_destructor (void *value) 
+{
+    (void) value;
+    mpool_setcache (0);
+}
+#endif
+
+/**
+ * @brief Allocate from a pool
+ * 
+ * @param pool
+ * @param size
+ * @return 
+******************************************************************************/
+void *mpool_malloc (struct mpool *pool, size_t size) 
+{
+    void *ret = NULL;
+    struct mpool_block *block, *new_block, **pp;
+    size_t remain, block_size;
+    
+    if(!pool || !pool->block || !size)
+	return NULL;
+    
+    size = (size + 15) & ~0xF; /* This is to align memory allocation on 
+                                * multiple 16 boundary */
+    
+    block = pool->block;
+    remain = block->size - ((size_t)block->free - (size_t)block->bp);
+    
+    if (remain < size) 
+    {
+        /* Take a spare block which is big enough */
+        for (pp = &pool->spare; *pp; pp = &(*pp)->next)
+            if ((*pp)->size >= size)
+                break;
+        
+        if (*pp)
+        {
+            new_block = *pp;
+            *pp = new_block->next;
+        }
+        else
+        {
+            /* Allocate a new block; the blocks grow geometrically */
+            block_size = mpool_next_block_size (block, size);
+            new_block = mpool_new_block (block_size, pool->pages);
+        }
+	new_block->next = block;
+	block = pool->block = new_block;
+    }
+    
+    ret = block->free;
+    
+    block->free = block->bp + (block->free - block->bp + size);
+    
+    return ret;
+}
+
+/**
+ * @brief Finds the size of the block that is allocated after the given one
+ * 
+ * @param block the current block
+ * @param size the size of the allocation that does not fit in the block
+ * @return 
+ *****************************************************************************/
+static size_t mpool_next_block_size (struct mpool_block *block, size_t size)
+{
+    size_t block_size = block->size * 2;
+    
+    if (block_size > MPOOL_BLOCK_MAX_SIZE)
+        block_size = (block->size > MPOOL_BLOCK_MAX_SIZE) ? 
+                MPOOL_BLOCK_MAX_SIZE : block->size;
+    
+    return (block_size < size) ? size : block_size;
+}
+
+/**
+ * @brief Finds how much the pool grows to make the given allocation
+ * 
+ * @param pool
+ * @param size the size of the allocation
+ * @return the size of the new block, or 0 if the current block or a spare 
+ * one has room for it
+ *****************************************************************************/
+size_t mpool_growth (struct mpool *pool, size_t size) 
+{
+    struct mpool_block *block = pool->block, *p;
+    
+    size = (size + 15) & ~0xF;
+    
+    if (block->size - (size_t)(block->free - block->bp) >= size)
+        return 0;
+    
+    for (p = pool->spare; p; p = p->next)
+        if (p->size >= size)
+            return 0;
+    
+    return mpool_next_block_size (block, size);
+}
+
+/**
+ * @brief Makes a copy of a string with known size. The string may contain 
+ * null bytes.
+ * 
+ * @param pool
+ * @param str
+ * @param n
+ * @return 
+ *****************************************************************************/
+void *mpool_strndup (struct mpool *pool, const char *str, size_t n) 
+{
+    void *ret;
+    
+    if (!str)
+        return NULL;
+    
+    if ((ret = mpool_malloc(pool, n+1)))
+    {
+        memcpy(ret, str, n);
+        ((char *)ret)[n] = '\0';
+    }
+    
+    return ret;
+}
+
+/**
+ * @brief Makes a copy of zero terminated string
+ * 
+ * @param pool
+ * @param str
+ * @return 
+******************************************************************************/
+void *mpool_strdup (struct mpool *pool, const char *str) 
+{
+    size_t len;
+    
+    if (!str) 
+        return NULL;
+    len = strlen(str);
+    
+    return mpool_strndup (pool, str, len);
+}
+
+/**
+ * @brief Sets the page mode of the blocks that are allocated from now on
+ * 
+ * The huge page modes are only available on Linux; elsewhere they are 
+ * ignored.
+ * 
+ * @param pool
+ * @param mode
+******************************************************************************/
+void mpool_setpages (struct mpool *pool, enum mpool_pages mode) 
+{
+    struct mpool_block **pp, *p;
+    
+    pool->pages = mode;
+    
+    /* Drop the spare blocks of the other modes */
+    pp = &pool->spare;
+    while ((p = *pp))
+    {
+        if (p->pages != mode)
+        {
+            *pp = p->next;
+            p->next = NULL;
+            mpool_free_blocks (p);
+        }
+        else
+        {
+            pp = &p->next;
+        }
+    }
+}
+
+/**
+ * @brief Returns the page mode of the pool
+ * 
+ * @param pool
+ * @return 
+******************************************************************************/
+enum mpool_pages mpool_getpages (struct mpool *pool) 
+{
+    return pool->pages;
+}
+
+/**
+ * @brief Finds the total size of the pool blocks
+ * 
+ * @param pool
+ * @return the size in bytes
+******************************************************************************/
+size_t mpool_size (struct mpool *pool) 
+{
+    struct mpool_block *p;
+    size_t bytes = 0;
+    
+    for (p = pool->block; p; p = p->next)
+        bytes += p->size;
+    
+    for (p = pool->spare; p; p = p->next)
+        bytes += p->size;
+    
+    return bytes;
+}
+
+/**
+ * @brief Finds how much of the pool is actually backed by huge pages
+ * 
+ * The hugetlbfs blocks are huge pages by definition. For the transparent 
+ * huge page blocks, the advice may or may not have been followed by the 
+ * kernel, so their mappings are looked up in /proc/self/smaps. The kernel 
+ * reports AnonHugePages per mapping, and a mapping may be merged with 
+ * neighbouring memory that is not ours; so the count of each mapping is 
+ * clamped to the size of our blocks inside it. The result is therefore an 
+ * upper bound of the transparent huge pages, not an exact figure.
+ * 
+ * @param pool
+ * @return the number of bytes backed by huge pages
+******************************************************************************/
+size_t mpool_hugepages (struct mpool *pool) 
+{
+    struct mpool_block *p;
+    size_t bytes = 0;
+    int has_huge = 0;
+#ifdef MPOOL_MMAP
+    FILE *smaps;
+    char line[256];
+    unsigned long start, end, kb, from, to;
+    size_t overlap = 0;
+#endif
+    
+    for (p = pool->block; p; p = p->next)
+    {
+        if (p->pages == MPOOL_PAGES_HUGETLB)
+            bytes += p->size;
+        else if (p->pages == MPOOL_PAGES_HUGE)
+            has_huge = 1;
+    }
+    
+#ifdef MPOOL_MMAP
+    if (!has_huge || !(smaps = fopen ("/proc/self/smaps", "r")))
+        return bytes;
+    
+    while (fgets (line, sizeof(line), smaps))
+    {
+        if (sscanf (line, "%lx-%lx ", &start, &end) == 2)
+        {
+            /* A new mapping: how much of our blocks is in it? */
+            overlap = 0;
+            for (p = pool->block; p; p = p->next)
+            {
+                if (p->pages != MPOOL_PAGES_HUGE)
+                    continue;
+                from = (unsigned long) p->bp;
+                to = from + p->size;
+                if (from < start)
+                    from = start;
+                if (to > end)
+                    to = end;
+                if (from < to)
+                    overlap += to - from;
+            }
+        }
+        else if (overlap && sscanf (line, "AnonHugePages: %lu kB", &kb) == 1)
+        {
+            bytes += (kb * 1024 < overlap) ? kb * 1024 : overlap;
+        }
+    }
+    
+    fclose (smaps);
+#endif
+    
+    return bytes;
+}
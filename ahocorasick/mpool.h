@@ -1,44 +1,70 @@
-/*
- * mpool.c memory pool management
- * This file is part of multifast.
- *
-    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
-
-    multifast is free software: you can redistribute it and/or modify
-    it under the terms of the GNU Lesser General Public License as published by
-    the Free Software Foundation, either version 3 of the License, or
-    (at your option) any later version.
-
-    multifast is distributed in the hope that it will be useful,
-    but WITHOUT ANY WARRANTY; without even the implied warranty of
-    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-    GNU Lesser General Public License for more details.
-
-    You should have received a copy of the GNU Lesser General Public License
-    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
-*/
-
-#ifndef _MPOOL_H_
-#define	_MPOOL_H_
-
-#ifdef	__cplusplus
-extern "C" {
-#endif
-
-/* Forward declaration */
-struct mpool;
-
-
-struct mpool *mpool_create (size_t size);
-void mpool_free (struct mpool *pool);
-
-void *mpool_malloc (struct mpool *pool, size_t size);
-void *mpool_strdup (struct mpool *pool, const char *str);
-void *mpool_strndup (struct mpool *pool, const char *str, size_t n);
-
-
-#ifdef	__cplusplus
-}
-#endif
-
-#endif	/* _MPOOL_H_ */
+/*
+ * mpool.c memory pool management
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MPOOL_H_
+#define	_MPOOL_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Forward declaration */
+struct mpool;
+
+/**
+ * Page modes of the pool blocks
+ */
+enum mpool_pages
+{
+    MPOOL_PAGES_DEFAULT = 0,    /**< Blocks are allocated with malloc */
+    MPOOL_PAGES_HUGE,           /**< Blocks are 2 MB aligned mappings advised 
+                                 * to use transparent huge pages */
+    MPOOL_PAGES_HUGETLB         /**< Blocks are mapped from the hugetlbfs 
+                                 * pool; falls back to MPOOL_PAGES_HUGE if 
+                                 * no huge page is available */
+};
+
+/**
+ * Size of a huge page
+ */
+#define MPOOL_HUGE_PAGE_SIZE (2*1024*1024)
+
+
+struct mpool *mpool_create (size_t size, enum mpool_pages pages);
+void mpool_free (struct mpool *pool);
+void mpool_reset (struct mpool *pool);
+void mpool_setcache (size_t count);
+
+void mpool_setpages (struct mpool *pool, enum mpool_pages mode);
+enum mpool_pages mpool_getpages (struct mpool *pool);
+size_t mpool_hugepages (struct mpool *pool);
+size_t mpool_size (struct mpool *pool);
+size_t mpool_growth (struct mpool *pool, size_t size);
+
+void *mpool_malloc (struct mpool *pool, size_t size);
+void *mpool_strdup (struct mpool *pool, const char *str);
+void *mpool_strndup (struct mpool *pool, const char *str, size_t n);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _MPOOL_H_ */
@@ -29,12 +29,15 @@
 /* Privates */
 static void node_init (ACT_NODE_t *thiz);
 static int  node_edge_compare (const void *l, const void *r);
-static int  node_has_pattern (ACT_NODE_t *thiz, AC_PATTERN_t *patt);
 static void node_grow_outgoing_vector (ACT_NODE_t *thiz);
 static void node_grow_matched_vector (ACT_NODE_t *thiz);
 static void node_copy_pattern (ACT_NODE_t *thiz, 
         AC_PATTERN_t *to, AC_PATTERN_t *from);
 
+/* Friends */
+extern unsigned int ac_trie_pattern_checks 
+    (struct ac_trie *thiz, AC_PATTERN_t *patt);
+
 /**
  * @brief Creates the node
  * 
@@ -67,6 +70,7 @@ static void node_init (ACT_NODE_t *thiz)
     thiz->matched = NULL;
     thiz->matched_capacity = 0;
     thiz->matched_size = 0;
+    thiz->matched_checks = 0;
     
     thiz->outgoing = NULL;
     thiz->outgoing_capacity = 0;
@@ -82,6 +86,10 @@ static void node_init (ACT_NODE_t *thiz)
  *****************************************************************************/
 void node_release_vectors(ACT_NODE_t *nod)
 {
+    nod->trie->vectors_size -= 
+            nod->outgoing_capacity * sizeof(struct act_edge) + 
+            nod->matched_capacity * sizeof(AC_PATTERN_t);
+    
     free(nod->matched);
     free(nod->outgoing);
 }
@@ -110,7 +118,8 @@ ACT_NODE_t * node_find_next(ACT_NODE_t *nod, AC_ALPHABET_t alpha)
 /**
  * @brief Finds out the next node for a given alpha. this function is used 
  * after the pre-processing stage in which we sort edges. so it uses Binary 
- * Search.
+ * Search, or a linear scan that stops at the first greater edge for the 
+ * nodes with up to NODE_LINEAR_SEARCH_MAX edges.
  * 
  * @param thiz
  * @param alpha
@@ -118,10 +127,23 @@ ACT_NODE_t * node_find_next(ACT_NODE_t *nod, AC_ALPHABET_t alpha)
  *****************************************************************************/
 ACT_NODE_t *node_find_next_bs (ACT_NODE_t *nod, AC_ALPHABET_t alpha)
 {
-    size_t mid;
+    size_t i, mid;
     int min, max;
     AC_ALPHABET_t amid;
 
+    if (nod->outgoing_size <= NODE_LINEAR_SEARCH_MAX)
+    {
+        for (i = 0; i < nod->outgoing_size; i++)
+        {
+            amid = nod->outgoing[i].alpha;
+            if (amid == alpha)
+                return (nod->outgoing[i].next);
+            if (amid > alpha)
+                break;
+        }
+        return NULL;
+    }
+
     min = 0;
     max = nod->outgoing_size - 1;
 
@@ -141,13 +163,13 @@ ACT_NODE_t *node_find_next_bs (ACT_NODE_t *nod, AC_ALPHABET_t alpha)
 
 /**
  * @brief Determines if a final node contains a pattern in its accepted pattern
- * list or not.
+ * list or not. The same string with other flags is another pattern.
  * 
  * @param thiz
  * @param newstr
  * @return 1: has the pattern, 0: doesn't have it
  *****************************************************************************/
-static int node_has_pattern (ACT_NODE_t *thiz, AC_PATTERN_t *patt)
+int node_has_pattern (ACT_NODE_t *thiz, AC_PATTERN_t *patt)
 {
     size_t i, j;
     AC_TEXT_t *txt;
@@ -157,7 +179,8 @@ static int node_has_pattern (ACT_NODE_t *thiz, AC_PATTERN_t *patt)
     {
         txt = &thiz->matched[i].ptext;
         
-        if (txt->length != new_txt->length)
+        if (txt->length != new_txt->length || 
+                thiz->matched[i].flags != patt->flags)
             continue;
         
         /* The following loop is futile! Because the input pattern always come 
@@ -215,6 +238,7 @@ void node_accept_pattern (ACT_NODE_t *nod, AC_PATTERN_t *new_patt, int copy)
         node_grow_matched_vector (nod);
     
     patt = &nod->matched[nod->matched_size++];
+    nod->matched_checks |= ac_trie_pattern_checks (nod->trie, new_patt);
     
     if (copy)
     {
@@ -238,7 +262,7 @@ void node_accept_pattern (ACT_NODE_t *nod, AC_PATTERN_t *new_patt, int copy)
 static void node_copy_pattern
     (ACT_NODE_t *thiz, AC_PATTERN_t *to, AC_PATTERN_t *from)
 {
-    struct mpool *mp = thiz->trie->mp;
+    struct mpool *mp = thiz->trie->string_mp;
     
     to->ptext.astring = (AC_ALPHABET_t *) mpool_strndup (mp, 
         (const char *) from->ptext.astring, 
@@ -257,6 +281,7 @@ static void node_copy_pattern
         to->id.u.number = from->id.u.number;
     
     to->id.type = from->id.type;
+    to->flags = from->flags;
 }
 
 /**
@@ -320,6 +345,9 @@ static int node_edge_compare (const void *l, const void *r)
  *****************************************************************************/
 void node_sort_edges (ACT_NODE_t *nod)
 {
+    if (nod->outgoing_size < 2)
+        return; /* The leaves have no edge vector at all */
+    
     qsort ((void *)nod->outgoing, nod->outgoing_size, 
             sizeof(struct act_edge), node_edge_compare);
 }
@@ -388,6 +416,8 @@ static void node_grow_outgoing_vector (ACT_NODE_t *thiz)
                 thiz->outgoing, 
                 thiz->outgoing_capacity * sizeof(struct act_edge));
     }
+    
+    thiz->trie->vectors_size += grow_factor * sizeof(struct act_edge);
 }
 
 /**
@@ -397,6 +427,8 @@ static void node_grow_outgoing_vector (ACT_NODE_t *thiz)
  *****************************************************************************/
 static void node_grow_matched_vector (ACT_NODE_t *thiz)
 {
+    size_t old_capacity = thiz->matched_capacity;
+    
     if (thiz->matched_capacity == 0)
     {
         thiz->matched_capacity = 1;
@@ -410,6 +442,9 @@ static void node_grow_matched_vector (ACT_NODE_t *thiz)
                 thiz->matched,
                 thiz->matched_capacity * sizeof(AC_PATTERN_t));
     }
+    
+    thiz->trie->vectors_size += 
+            (thiz->matched_capacity - old_capacity) * sizeof(AC_PATTERN_t);
 }
 
 /**
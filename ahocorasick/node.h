@@ -49,6 +49,9 @@ typedef struct act_node
     AC_PATTERN_t *matched;      /**< Matched patterns array */
     size_t matched_capacity;    /**< Max capacity of the matched patterns */
     size_t matched_size;        /**< Number of matched patterns in this node */
+    unsigned int matched_checks; /**< Bitwise OR of the checks of the matched
+                                  * patterns; non-zero means that matches must
+                                  * be filtered before reporting */
     
     AC_PATTERN_t *to_be_replaced;   /**< Pointer to the pattern that must be 
                                      * replaced */
@@ -57,6 +60,47 @@ typedef struct act_node
     
 } ACT_NODE_t;
 
+/**
+ * Pattern flags which can not be checked until the byte after the match is 
+ * available
+ */
+#define AC_PATTFLAG_LOOKAHEAD (AC_PATTFLAG_WORD_END|AC_PATTFLAG_LINE_END)
+
+/**
+ * Internal check: the pattern is case sensitive in a trie that folds case, 
+ * so the matched bytes must be compared with the pattern
+ */
+#define AC_PATTFLAG_VERIFY 0x100
+
+/**
+ * Sorted nodes with up to this many edges are searched linearly; the scan of
+ * a few adjacent edges beats the mispredicted branches of a binary search.
+ * bench/microbench.c, medians of 7 runs, 3 invocations: with uniformly random
+ * edge bytes the linear scan was last faster at 32 edges twice and at 64 once
+ * (losing at 48 in the other two); with lower case letters it was faster at
+ * every fan-out up to the 26 that the alphabet allows.
+ */
+#define NODE_LINEAR_SEARCH_MAX 32
+
+/**
+ * Hints the CPU to start loading the memory at the address
+ */
+#if defined(__GNUC__)
+#define AC_PREFETCH(addr) __builtin_prefetch (addr)
+#else
+#define AC_PREFETCH(addr)
+#endif
+
+/**
+ * Updates the runtime counters of the trie. The statements are only 
+ * compiled in when the library is built with AC_COUNTERS defined.
+ */
+#ifdef AC_COUNTERS
+#define AC_COUNT(statements) do { statements; } while (0)
+#else
+#define AC_COUNT(statements)
+#endif
+
 /**
  * Edge of the node 
  */
@@ -79,6 +123,7 @@ void node_assign_id (ACT_NODE_t *nod);
 void node_add_edge (ACT_NODE_t *nod, ACT_NODE_t *next, AC_ALPHABET_t alpha);
 void node_sort_edges (ACT_NODE_t *nod);
 void node_accept_pattern (ACT_NODE_t *nod, AC_PATTERN_t *new_patt, int copy);
+int  node_has_pattern (ACT_NODE_t *nod, AC_PATTERN_t *patt);
 void node_collect_matches (ACT_NODE_t *nod);
 void node_release_vectors (ACT_NODE_t *nod);
 int  node_book_replacement (ACT_NODE_t *nod);
@@ -0,0 +1,617 @@
+/*
+ * parallel.c: Implements the replacement on several threads
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <pthread.h>
+
+#include "node.h"
+#include "ahocorasick.h"
+#include "prefilter.h"
+
+/* Maximum length of an output segment; writev() on Linux writes at most
+ * 0x7ffff000 bytes at once, so the contiguous spans are cut below that. The
+ * tests build with a small one. */
+#ifndef MF_PARALLEL_SPAN_MAX
+#define MF_PARALLEL_SPAN_MAX 0x40000000
+#endif
+
+/**
+ * A nominee of a segment
+ */
+struct mf_parallel_nominee
+{
+    AC_PATTERN_t *pattern;
+    size_t position;    /**< End position in the whole input */
+    int kept;           /**< The nominee is replaced */
+};
+
+/**
+ * A segment of the input and the nominees that end in it
+ */
+struct mf_parallel_segment
+{
+    AC_TRIE_t *trie;        /**< The trie, which is only read */
+    AC_TEXT_t *text;        /**< The whole input */
+    MF_REPLACE_MODE_t mode;
+    size_t from;            /**< Start of the segment in the input */
+    size_t to;              /**< End of the segment in the input */
+
+    struct mf_parallel_nominee *noms;
+    size_t noms_size;
+    size_t noms_capacity;
+    size_t longest;         /**< Length of the longest pattern */
+    size_t last_end;        /**< End of the last kept nominee, in the lazy
+                             * mode */
+    int failed;             /**< The nominees could not be allocated */
+    int done;               /**< The segment is scanned */
+};
+
+/**
+ * The segments that are given to the threads. They are kept in a ring,
+ * which is refilled in the order of the input as the output of its segments
+ * is passed.
+ */
+struct mf_parallel_ring
+{
+    struct mf_parallel_segment *segs;
+    size_t size;            /**< Number of the segments in the ring */
+    size_t given;           /**< Number of the segments given so far */
+    size_t taken;           /**< Number of the segments taken to be scanned */
+    size_t offset;          /**< The input is given up to here */
+    int stop;               /**< The threads must return */
+
+    AC_TRIE_t *trie;
+    AC_TEXT_t *text;
+    MF_REPLACE_MODE_t mode;
+
+    pthread_mutex_t lock;
+    pthread_cond_t more;    /**< A segment is given, or stop is set */
+    pthread_cond_t scanned; /**< A segment is scanned */
+};
+
+/**
+ * The output of multifast_replace_parallel(), which is passed in order
+ */
+struct mf_parallel_output
+{
+    AC_TEXT_t segments[MF_REPLACEMENT_SEGMENTS];
+    size_t size;
+    size_t curser;          /**< The input is written up to here */
+    size_t last_end;        /**< End of the last replaced nominee */
+    MF_REPLACE_SEGMENTS_CALBACK_f callback;
+    void *param;
+};
+
+/* Privates */
+
+static void *mf_parallel_work (void *arg);
+static void mf_parallel_give (struct mf_parallel_ring *ring);
+static void mf_parallel_take (struct mf_parallel_ring *ring);
+static void mf_parallel_scan (struct mf_parallel_segment *seg);
+static void mf_parallel_book (struct mf_parallel_segment *seg,
+        AC_PATTERN_t *pattern, size_t position);
+static void mf_parallel_emit (struct mf_parallel_segment *seg,
+        struct mf_parallel_output *out);
+static void mf_parallel_append (struct mf_parallel_output *out,
+        const AC_ALPHABET_t *astring, size_t length);
+static void mf_parallel_flush (struct mf_parallel_output *out);
+
+/* Friends */
+
+extern AC_PATTERN_t *mf_repdata_pickpattern_text (AC_TRIE_t *thiz,
+        ACT_NODE_t *node, const AC_TEXT_t *text, size_t offset,
+        size_t position, int eot);
+
+
+/**
+ * @brief Replaces the patterns in the given text on several threads, and
+ * passes the result to the call-back function in order, as a vector of
+ * segments like multifast_replacev(). The output is the same as that of
+ * multifast_replace() in the same mode. The text is a whole input, and the
+ * stream of the trie is neither used nor changed.
+ *
+ * The text is cut into segments of MF_PARALLEL_SEGMENT bytes, and each thread
+ * finds the nominees that end in its segment. A thread starts reading as
+ * many bytes as the longest pattern before its segment, which brings the
+ * automaton to the state that a sequential pass would have there, and reads
+ * as many bytes past it. The normal mode only drops a nominee for one that 
+ * starts at or before it and ends within that distance, so its nominees are 
+ * settled by the thread. In the lazy mode a nominee is dropped for any 
+ * overlapping one before it, so its choice is redone at the seam, in order, 
+ * until it agrees with the choice of the thread.
+ *
+ * The threads are started once and take the segments from a ring of twice as
+ * many segments. The calling thread passes the output of the segments in
+ * order and gives the next segments, so that the output overlaps the scan of
+ * the segments after it; while the next segment in order is not scanned yet,
+ * it scans the waiting segments itself.
+ *
+ * @param thiz
+ * @param text
+ * @param mode
+ * @param threads the number of threads, including the calling one; 0 is
+ * taken as 1
+ * @param callback
+ * @param param
+ * @return 0 on success, -1 if the trie is open, -2 if the trie has no
+ * to-be-replaced pattern, -4 if the memory could not be allocated. On -4 the
+ * output that is still held is dropped, but a prefix of the output may have
+ * been passed to the call-back already, so it must be discarded.
+ *****************************************************************************/
+int multifast_replace_parallel (AC_TRIE_t *thiz, AC_TEXT_t *text,
+        MF_REPLACE_MODE_t mode, unsigned int threads,
+        MF_REPLACE_SEGMENTS_CALBACK_f callback, void *param)
+{
+    struct mf_parallel_ring ring;
+    struct mf_parallel_segment *seg;
+    struct mf_parallel_output out;
+    pthread_t *tids;
+    size_t passed = 0, workers = 0, i;
+    int ret = 0;
+
+    if (thiz->trie_open)
+        return -1; /* _finalize() must be called first */
+
+    if (!thiz->repdata.has_replacement)
+        return -2; /* Trie doesn't have any to-be-replaced pattern */
+
+    if (threads == 0)
+        threads = 1;
+
+    ring.size = 2 * (size_t) threads;
+    ring.segs = (struct mf_parallel_segment *)
+            calloc (ring.size, sizeof(struct mf_parallel_segment));
+    tids = (pthread_t *) malloc (threads * sizeof(pthread_t));
+
+    if (!ring.segs || !tids)
+    {
+        free (ring.segs);
+        free (tids);
+        return -4;
+    }
+
+    ring.given = 0;
+    ring.taken = 0;
+    ring.offset = 0;
+    ring.stop = 0;
+    ring.trie = thiz;
+    ring.text = text;
+    ring.mode = mode;
+    pthread_mutex_init (&ring.lock, NULL);
+    pthread_cond_init (&ring.more, NULL);
+    pthread_cond_init (&ring.scanned, NULL);
+
+    out.size = 0;
+    out.curser = 0;
+    out.last_end = 0;
+    out.callback = callback;
+    out.param = param;
+
+    while (ring.given < ring.size && ring.offset < text->length)
+        mf_parallel_give (&ring);
+
+    /* The calling thread is one of the threads; if some cannot be started,
+     * their share is scanned by the others */
+    for (i = 1; i < threads; i++)
+        if (!pthread_create (&tids[workers], NULL, mf_parallel_work, &ring))
+            workers++;
+
+    pthread_mutex_lock (&ring.lock);
+
+    while (passed < ring.given && ret == 0)
+    {
+        seg = &ring.segs[passed % ring.size];
+
+        while (!seg->done)
+        {
+            if (ring.taken < ring.given)
+                mf_parallel_take (&ring);
+            else
+                pthread_cond_wait (&ring.scanned, &ring.lock);
+        }
+
+        /* The segment is not touched by the other threads until it is given
+         * again */
+        pthread_mutex_unlock (&ring.lock);
+
+        if (seg->failed)
+            ret = -4;
+        else
+            mf_parallel_emit (seg, &out);
+
+        pthread_mutex_lock (&ring.lock);
+
+        passed++;
+        while (ring.given < passed + ring.size && ring.offset < text->length)
+        {
+            mf_parallel_give (&ring);
+            pthread_cond_signal (&ring.more);
+        }
+    }
+
+    ring.stop = 1;
+    pthread_cond_broadcast (&ring.more);
+    pthread_mutex_unlock (&ring.lock);
+
+    for (i = 0; i < workers; i++)
+        pthread_join (tids[i], NULL);
+
+    if (ret == 0)
+    {
+        /* The rest of the input after the last replacement */
+        if (text->length > out.curser)
+            mf_parallel_append (&out, &text->astring[out.curser],
+                    text->length - out.curser);
+
+        mf_parallel_flush (&out);
+    }
+
+    for (i = 0; i < ring.size; i++)
+        free (ring.segs[i].noms);
+    free (ring.segs);
+    free (tids);
+
+    pthread_cond_destroy (&ring.scanned);
+    pthread_cond_destroy (&ring.more);
+    pthread_mutex_destroy (&ring.lock);
+
+    return ret;
+}
+
+/**
+ * @brief Runs a thread, which scans the segments that are given to the ring
+ * until it is stopped
+ *
+ * @param arg the ring
+ * @return NULL
+ *****************************************************************************/
+static void *mf_parallel_work (void *arg)
+{
+    struct mf_parallel_ring *ring = (struct mf_parallel_ring *) arg;
+
+    pthread_mutex_lock (&ring->lock);
+
+    while (1)
+    {
+        while (!ring->stop && ring->taken == ring->given)
+            pthread_cond_wait (&ring->more, &ring->lock);
+
+        if (ring->stop)
+            break;
+
+        mf_parallel_take (ring);
+    }
+
+    pthread_mutex_unlock (&ring->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Gives the next segment of the input to the ring. The lock must be
+ * held once the threads are started.
+ *
+ * @param ring
+ *****************************************************************************/
+static void mf_parallel_give (struct mf_parallel_ring *ring)
+{
+    struct mf_parallel_segment *seg = &ring->segs[ring->given % ring->size];
+    size_t rest = ring->text->length - ring->offset;
+
+    /* The nominees array is kept for the next segment of the slot */
+    seg->trie = ring->trie;
+    seg->text = ring->text;
+    seg->mode = ring->mode;
+    seg->from = ring->offset;
+    seg->to = ring->offset +
+            ((rest > MF_PARALLEL_SEGMENT) ? MF_PARALLEL_SEGMENT : rest);
+    seg->noms_size = 0;
+    seg->last_end = 0;
+    seg->failed = 0;
+    seg->done = 0;
+
+    ring->offset = seg->to;
+    ring->given++;
+}
+
+/**
+ * @brief Takes the next given segment and scans it. It is called with the
+ * lock held, which is released during the scan.
+ *
+ * @param ring
+ *****************************************************************************/
+static void mf_parallel_take (struct mf_parallel_ring *ring)
+{
+    struct mf_parallel_segment *seg = &ring->segs[ring->taken % ring->size];
+
+    ring->taken++;
+
+    pthread_mutex_unlock (&ring->lock);
+    mf_parallel_scan (seg);
+    pthread_mutex_lock (&ring->lock);
+
+    seg->done = 1;
+    pthread_cond_signal (&ring->scanned);
+}
+
+/**
+ * @brief Finds the nominees that end in a segment. It may run on any of
+ * the threads and only reads the trie; the boundary checks read the bytes
+ * around a match from the whole input.
+ *
+ * @param seg
+ *****************************************************************************/
+static void mf_parallel_scan (struct mf_parallel_segment *seg)
+{
+    AC_TRIE_t *trie = seg->trie;
+    AC_TEXT_t *text = seg->text;
+    ACT_NODE_t *current, *next;
+    AC_PATTERN_t *pattern;
+    AC_ALPHABET_t alpha;
+    const AC_ALPHABET_t *xlat = trie->xlat;
+    AC_PREFILTER_t *prefilter = trie->prefilter;
+    size_t position, end;
+
+    /* The nodes are numbered in breadth-first order */
+    seg->longest = trie->nodes[trie->nodes_count - 1]->depth;
+
+    position = (seg->from > seg->longest) ? seg->from - seg->longest : 0;
+    end = (text->length - seg->to > seg->longest) ?
+            seg->to + seg->longest : text->length;
+
+    current = trie->root;
+
+    /* The same loop as multifast_replace() */
+    while (position < end)
+    {
+        if (prefilter && current == trie->root &&
+                !prefilter->start[(unsigned char) text->astring[position]])
+        {
+            position = prefilter_skip (prefilter, text->astring,
+                    position, end);
+            if (position == end)
+                break;
+        }
+
+        alpha = text->astring[position];
+        if (xlat)
+            alpha = xlat[(unsigned char) alpha];
+
+        if (!(next = node_find_next_bs (current, alpha)))
+        {
+            if (current->failure_node)
+                current = current->failure_node;
+            else
+                position++;
+        }
+        else
+        {
+            current = next;
+            position++;
+        }
+
+        /* Matches which end before the segment do not change the nominees
+         * of the segment */
+        if (current->final && next && position > seg->from)
+        {
+            pattern = current->to_be_replaced;
+
+            if (current->matched_checks && pattern)
+                pattern = mf_repdata_pickpattern_text (trie, current, text,
+                        0, position, position == text->length);
+
+            if (pattern)
+                mf_parallel_book (seg, pattern, position);
+        }
+    }
+}
+
+/**
+ * @brief Books a nominee of a segment. In the normal mode the nominees that
+ * start at or after the new one are dropped, and the nominees that end after 
+ * the segment are only booked to drop others. In the lazy mode only the 
+ * nominees that end in the segment are booked, with the choice of a pass 
+ * that starts at the segment.
+ *
+ * @param seg
+ * @param pattern
+ * @param position the end of the nominee in the input
+ *****************************************************************************/
+static void mf_parallel_book (struct mf_parallel_segment *seg,
+        AC_PATTERN_t *pattern, size_t position)
+{
+    struct mf_parallel_nominee *noms;
+    size_t start = position - pattern->ptext.length;
+    size_t capacity;
+    int kept = 1;
+
+    switch (seg->mode)
+    {
+        case MF_REPLACE_MODE_LAZY:
+
+            if (position > seg->to)
+                return;
+
+            if (start < seg->last_end)
+                kept = 0;
+            else
+                seg->last_end = position;
+            break;
+
+        case MF_REPLACE_MODE_DEFAULT:
+        case MF_REPLACE_MODE_NORMAL:
+        default:
+
+            while (seg->noms_size > 0 && start <=
+                    seg->noms[seg->noms_size - 1].position -
+                    seg->noms[seg->noms_size - 1].pattern->ptext.length)
+                seg->noms_size--;
+
+            /* The nominees that end after the segment are only looked at to
+             * drop others */
+            if (position > seg->to)
+                kept = 0;
+            break;
+    }
+
+    if (seg->noms_size == seg->noms_capacity)
+    {
+        capacity = seg->noms_capacity ? 2 * seg->noms_capacity : 256;
+        noms = (struct mf_parallel_nominee *) realloc (seg->noms,
+                capacity * sizeof(struct mf_parallel_nominee));
+        if (!noms)
+        {
+            seg->failed = 1;
+            return;
+        }
+        seg->noms = noms;
+        seg->noms_capacity = capacity;
+    }
+
+    noms = &seg->noms[seg->noms_size++];
+    noms->pattern = pattern;
+    noms->position = position;
+    noms->kept = kept;
+}
+
+/**
+ * @brief Passes the output of a segment, after the output of all the
+ * segments before it
+ *
+ * @param seg
+ * @param out
+ *****************************************************************************/
+static void mf_parallel_emit (struct mf_parallel_segment *seg,
+        struct mf_parallel_output *out)
+{
+    struct mf_parallel_nominee *nom;
+    const AC_ALPHABET_t *astring = seg->text->astring;
+    size_t i, start, last_end, safe;
+    int kept;
+
+    /* A lazy nominee that starts before the end of the last replacement is
+     * dropped; the choice of the thread is redone up to the first nominee
+     * that both keep, after which they agree */
+    if (seg->mode == MF_REPLACE_MODE_LAZY)
+    {
+        last_end = out->last_end;
+
+        for (i = 0; i < seg->noms_size; i++)
+        {
+            nom = &seg->noms[i];
+            kept = (nom->position - nom->pattern->ptext.length >= last_end);
+
+            if (kept && nom->kept)
+                break;
+
+            nom->kept = kept;
+            if (kept)
+                last_end = nom->position;
+        }
+    }
+
+    for (i = 0; i < seg->noms_size; i++)
+    {
+        nom = &seg->noms[i];
+
+        /* In the normal mode: the ones that only drop others */
+        if (!nom->kept || nom->position > seg->to)
+            continue;
+
+        /* The factor before the pattern, then its replacement */
+        start = nom->position - nom->pattern->ptext.length;
+        if (start > out->curser)
+            mf_parallel_append (out, &astring[out->curser],
+                    start - out->curser);
+
+        mf_parallel_append (out, nom->pattern->rtext.astring,
+                nom->pattern->rtext.length);
+
+        out->curser = nom->position;
+        out->last_end = nom->position;
+    }
+
+    /* The nominees of the next segments start after this point */
+    safe = (seg->to > seg->longest) ? seg->to - seg->longest : 0;
+    if (safe > out->curser)
+    {
+        mf_parallel_append (out, &astring[out->curser], safe - out->curser);
+        out->curser = safe;
+    }
+}
+
+/**
+ * @brief Appends a segment to the output; the segments that follow each
+ * other are merged, up to MF_PARALLEL_SPAN_MAX bytes
+ *
+ * @param out
+ * @param astring
+ * @param length
+ *****************************************************************************/
+static void mf_parallel_append (struct mf_parallel_output *out,
+        const AC_ALPHABET_t *astring, size_t length)
+{
+    AC_TEXT_t *last;
+    size_t span;
+
+    while (length > 0)
+    {
+        span = (length > MF_PARALLEL_SPAN_MAX) ? MF_PARALLEL_SPAN_MAX : length;
+
+        if (out->size > 0)
+        {
+            last = &out->segments[out->size - 1];
+
+            if (last->astring + last->length == astring &&
+                    last->length < MF_PARALLEL_SPAN_MAX)
+            {
+                if (span > MF_PARALLEL_SPAN_MAX - last->length)
+                    span = MF_PARALLEL_SPAN_MAX - last->length;
+                last->length += span;
+                astring += span;
+                length -= span;
+                continue;
+            }
+        }
+
+        if (out->size == MF_REPLACEMENT_SEGMENTS)
+            mf_parallel_flush (out);
+
+        out->segments[out->size].astring = astring;
+        out->segments[out->size].length = span;
+        out->size++;
+        astring += span;
+        length -= span;
+    }
+}
+
+/**
+ * @brief Passes the output to the call-back function
+ *
+ * @param out
+ *****************************************************************************/
+static void mf_parallel_flush (struct mf_parallel_output *out)
+{
+    if (out->size == 0)
+        return;
+
+    out->callback (out->segments, out->size, out->param);
+    out->size = 0;
+}
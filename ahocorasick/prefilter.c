@@ -0,0 +1,696 @@
+/*
+ * prefilter.c: Implements the root state prefilter of the trie
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "node.h"
+#include "ahocorasick.h"
+#include "prefilter.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PREFILTER_X86
+#include <immintrin.h>
+#endif
+
+/* The index of a block of 2 bytes in the Wu-Manber tables */
+#define PREFILTER_BLOCK(a,b) \
+    (((unsigned int)(unsigned char)(a) << 8) | (unsigned char)(b))
+
+/* Privates */
+
+static void prefilter_build_nibbles (AC_PREFILTER_t *thiz);
+static void prefilter_build_teddy (AC_PREFILTER_t *thiz, ACT_NODE_t *nod,
+        const AC_ALPHABET_t *xlat, AC_ALPHABET_t *fingerprint,
+        unsigned int *count);
+static void prefilter_build_wumanber (AC_PREFILTER_t *thiz,
+        ACT_NODE_t *nod, AC_ALPHABET_t last);
+static size_t prefilter_min_depth (ACT_NODE_t *nod);
+
+static size_t prefilter_skip_table (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length);
+static size_t prefilter_skip_nibbles (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length);
+static size_t prefilter_skip_wumanber (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length);
+
+#ifdef PREFILTER_X86
+static size_t prefilter_skip_bytes_sse2 (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length);
+
+static size_t prefilter_skip_nibbles_ssse3 (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length);
+
+static size_t prefilter_skip_nibbles_avx2 (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length);
+#endif
+
+
+/**
+ * @brief Creates the prefilter of a finalized trie
+ *
+ * Collects the bytes that take the automaton out of the root node and
+ * builds the tables of the search engine. With AC_ENGINE_AUTO, small
+ * pattern sets use Teddy, sets of long patterns use Wu-Manber and the others
+ * skip the bytes that are not start bytes.
+ *
+ * @param trie the trie; the edges of its root must be sorted
+ * @param engine the requested search engine
+ * @return the prefilter, or NULL if the prefilter is not worth using
+ *****************************************************************************/
+AC_PREFILTER_t *prefilter_create (struct ac_trie *trie, AC_ENGINE_t engine)
+{
+    AC_PREFILTER_t *thiz;
+    AC_ALPHABET_t alpha;
+    AC_ALPHABET_t fingerprint[AC_PREFILTER_MAX_WIDTH];
+    unsigned int i, count = 0;
+    size_t min_depth;
+
+    if (sizeof(AC_ALPHABET_t) != 1)
+        return NULL; /* The prefilter works on bytes */
+
+    if (engine == AC_ENGINE_AUTOMATON)
+        return NULL;
+
+    min_depth = prefilter_min_depth (trie->root);
+
+    if (engine == AC_ENGINE_AUTO)
+    {
+        if (trie->patterns_count <= AC_PREFILTER_TEDDY_MAX_PATTERNS)
+            engine = AC_ENGINE_TEDDY;
+        else if (min_depth >= AC_PREFILTER_WM_MIN_LENGTH)
+            engine = AC_ENGINE_WUMANBER;
+    }
+
+    if (min_depth < 2 || engine == AC_ENGINE_AUTO)
+        engine = AC_ENGINE_STARTBYTES;
+
+    thiz = (AC_PREFILTER_t *) malloc (sizeof(AC_PREFILTER_t));
+    thiz->engine = engine;
+    thiz->start_count = 0;
+    thiz->simd = 0;
+    thiz->width = 1;
+    thiz->xlat = trie->xlat;
+    thiz->wm_shift = NULL;
+    thiz->wm_prefix = NULL;
+
+    for (i = 0; i < 256; i++)
+    {
+        alpha = trie->xlat ? trie->xlat[i] : (AC_ALPHABET_t) i;
+
+        thiz->start[i] = node_find_next_bs (trie->root, alpha) ? 1 : 0;
+
+        if (thiz->start[i])
+        {
+            if (thiz->start_count < 3)
+                thiz->bytes[thiz->start_count] = (unsigned char) i;
+            thiz->start_count++;
+        }
+    }
+
+    if (engine == AC_ENGINE_WUMANBER)
+    {
+        thiz->type = AC_PREFILTER_WUMANBER;
+        thiz->wm_length = min_depth < AC_PREFILTER_WM_MAX_LENGTH ?
+                min_depth : AC_PREFILTER_WM_MAX_LENGTH;
+
+        thiz->wm_shift = (unsigned char *) malloc (AC_PREFILTER_BLOCKS);
+        memset (thiz->wm_shift, thiz->wm_length - 1, AC_PREFILTER_BLOCKS);
+        thiz->wm_prefix = (unsigned char *) calloc (AC_PREFILTER_BLOCKS / 8, 1);
+
+        prefilter_build_wumanber (thiz, trie->root, 0);
+        return thiz;
+    }
+    else if (engine == AC_ENGINE_TEDDY)
+    {
+        thiz->type = AC_PREFILTER_TEDDY;
+        thiz->width = min_depth < AC_PREFILTER_MAX_WIDTH ?
+                min_depth : AC_PREFILTER_MAX_WIDTH;
+
+        memset (thiz->lo_nibble, 0, sizeof(thiz->lo_nibble));
+        memset (thiz->hi_nibble, 0, sizeof(thiz->hi_nibble));
+        prefilter_build_teddy (thiz, trie->root, trie->xlat, fingerprint,
+                &count);
+    }
+    else if (thiz->start_count > AC_PREFILTER_MAX_BYTES)
+    {
+        free (thiz);
+        return NULL;
+    }
+    else if (thiz->start_count <= 3)
+    {
+        thiz->type = AC_PREFILTER_BYTES;
+#ifdef PREFILTER_X86
+        thiz->simd = __builtin_cpu_supports ("sse2");
+#endif
+        return thiz;
+    }
+    else
+    {
+        thiz->type = AC_PREFILTER_NIBBLES;
+        prefilter_build_nibbles (thiz);
+    }
+
+#ifdef PREFILTER_X86
+    if (__builtin_cpu_supports ("avx2"))
+        thiz->simd = 2;
+    else if (__builtin_cpu_supports ("ssse3"))
+        thiz->simd = 1;
+#endif
+
+    return thiz;
+}
+
+/**
+ * @brief Releases the prefilter
+ *
+ * @param thiz
+ *****************************************************************************/
+void prefilter_release (AC_PREFILTER_t *thiz)
+{
+    free (thiz->wm_shift);
+    free (thiz->wm_prefix);
+    free (thiz);
+}
+
+/**
+ * @brief Finds the memory size of the prefilter
+ *
+ * @param thiz
+ * @return the size in bytes
+ *****************************************************************************/
+size_t prefilter_size (AC_PREFILTER_t *thiz)
+{
+    size_t bytes = sizeof(AC_PREFILTER_t);
+
+    if (thiz->wm_shift)
+        bytes += AC_PREFILTER_BLOCKS + AC_PREFILTER_BLOCKS / 8;
+
+    return bytes;
+}
+
+/**
+ * @brief Finds the next position in the text at which the automaton may
+ * leave the root node.
+ *
+ * The result may be a false positive, i.e. a byte which does not leave the
+ * root, but no start byte is ever skipped.
+ *
+ * @param thiz
+ * @param text the input text
+ * @param position the position to start from
+ * @param length the length of the text
+ * @return the position of the next candidate byte, or @p length if there is
+ * no more candidate
+ *****************************************************************************/
+size_t prefilter_skip (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length)
+{
+    const AC_ALPHABET_t *found;
+
+    switch (thiz->type)
+    {
+        case AC_PREFILTER_BYTES:
+
+            if (thiz->start_count == 0)
+                return length;
+
+            if (thiz->start_count == 1)
+            {
+                found = (const AC_ALPHABET_t *) memchr (&text[position],
+                        thiz->bytes[0], length - position);
+                return found ? (size_t)(found - text) : length;
+            }
+#ifdef PREFILTER_X86
+            if (thiz->simd)
+                return prefilter_skip_bytes_sse2
+                        (thiz, text, position, length);
+#endif
+            break;
+
+        case AC_PREFILTER_NIBBLES:
+        case AC_PREFILTER_TEDDY:
+#ifdef PREFILTER_X86
+            if (thiz->simd == 2)
+                return prefilter_skip_nibbles_avx2
+                        (thiz, text, position, length);
+            if (thiz->simd)
+                return prefilter_skip_nibbles_ssse3
+                        (thiz, text, position, length);
+#endif
+            if (thiz->type == AC_PREFILTER_TEDDY)
+                return prefilter_skip_nibbles (thiz, text, position, length);
+            break;
+
+        case AC_PREFILTER_WUMANBER:
+            return prefilter_skip_wumanber (thiz, text, position, length);
+    }
+
+    return prefilter_skip_table (thiz, text, position, length);
+}
+
+/**
+ * @brief Builds the nibble tables
+ *
+ * A byte is a candidate if the bucket masks of its low and high nibbles have
+ * a common bit. The high nibbles that have the same set of low nibbles
+ * share a bucket. If there are more than 8 different sets, some buckets
+ * are merged, which only causes false positives.
+ *
+ * @param thiz
+ *****************************************************************************/
+static void prefilter_build_nibbles (AC_PREFILTER_t *thiz)
+{
+    unsigned int h, l, b;
+    unsigned int nbuckets = 0;
+    unsigned short lowset;
+    unsigned short buckets[8];
+
+    memset (thiz->lo_nibble, 0, sizeof(thiz->lo_nibble));
+    memset (thiz->hi_nibble, 0, sizeof(thiz->hi_nibble));
+
+    for (h = 0; h < 16; h++)
+    {
+        lowset = 0;
+        for (l = 0; l < 16; l++)
+            if (thiz->start[(h << 4) | l])
+                lowset |= 1 << l;
+
+        if (!lowset)
+            continue;
+
+        for (b = 0; b < nbuckets; b++)
+            if (buckets[b] == lowset)
+                break;
+
+        if (b == nbuckets)
+        {
+            if (nbuckets < 8)
+            {
+                buckets[nbuckets++] = lowset;
+            }
+            else
+            {
+                b = h % 8;
+                buckets[b] |= lowset;
+            }
+        }
+
+        thiz->hi_nibble[0][h] |= 1 << b;
+    }
+
+    for (b = 0; b < nbuckets; b++)
+        for (l = 0; l < 16; l++)
+            if (buckets[b] & (1 << l))
+                thiz->lo_nibble[0][l] |= 1 << b;
+}
+
+/**
+ * @brief Builds the Teddy nibble tables
+ *
+ * Every path of the trie as long as the prefilter width is a fingerprint.
+ * The fingerprints are spread over 8 buckets; the bytes of a fingerprint
+ * set the bit of its bucket in the tables of their offsets. A position is a
+ * candidate if the masks of all the offsets have a common bit.
+ *
+ * @param thiz
+ * @param nod the node to start from
+ * @param xlat the translation table of the trie; NULL for none
+ * @param fingerprint the path from the root to the node
+ * @param count number of the fingerprints added so far
+ *****************************************************************************/
+static void prefilter_build_teddy (AC_PREFILTER_t *thiz, ACT_NODE_t *nod,
+        const AC_ALPHABET_t *xlat, AC_ALPHABET_t *fingerprint,
+        unsigned int *count)
+{
+    unsigned char bucket;
+    unsigned int b;
+    size_t i;
+
+    if (nod->depth == thiz->width)
+    {
+        bucket = 1 << ((*count)++ % 8);
+
+        /* All the input bytes that translate to the fingerprint bytes */
+        for (i = 0; i < thiz->width; i++)
+            for (b = 0; b < 256; b++)
+                if ((xlat ? xlat[b] : (AC_ALPHABET_t) b) == fingerprint[i])
+                {
+                    thiz->lo_nibble[i][b & 0x0f] |= bucket;
+                    thiz->hi_nibble[i][b >> 4] |= bucket;
+                }
+        return;
+    }
+
+    for (i = 0; i < nod->outgoing_size; i++)
+    {
+        fingerprint[nod->depth] = nod->outgoing[i].alpha;
+        prefilter_build_teddy (thiz, nod->outgoing[i].next, xlat,
+                fingerprint, count);
+    }
+}
+
+/**
+ * @brief Builds the Wu-Manber tables
+ *
+ * The window is as long as the shortest pattern, so only the first
+ * wm_length bytes of the patterns, i.e. the paths of the trie up to that
+ * depth, are considered. The shift of a block is the distance between its
+ * end and the end of the window, the minimum over all the places it occurs.
+ * The blocks at the start of the window are recorded in the prefix bitmap.
+ *
+ * @param thiz
+ * @param nod the node to start from
+ * @param last the alphabet of the edge that leads to the node
+ *****************************************************************************/
+static void prefilter_build_wumanber (AC_PREFILTER_t *thiz,
+        ACT_NODE_t *nod, AC_ALPHABET_t last)
+{
+    ACT_NODE_t *next;
+    AC_ALPHABET_t alpha;
+    unsigned int block;
+    size_t i, shift;
+
+    if (nod->depth == thiz->wm_length)
+        return;
+
+    for (i = 0; i < nod->outgoing_size; i++)
+    {
+        next = nod->outgoing[i].next;
+        alpha = nod->outgoing[i].alpha;
+
+        if (nod->depth)
+        {
+            block = PREFILTER_BLOCK (last, alpha);
+            shift = thiz->wm_length - next->depth;
+
+            if (shift < thiz->wm_shift[block])
+                thiz->wm_shift[block] = (unsigned char) shift;
+
+            if (next->depth == 2)
+                thiz->wm_prefix[block >> 3] |= 1 << (block & 7);
+        }
+
+        prefilter_build_wumanber (thiz, next, alpha);
+    }
+}
+
+/**
+ * @brief Finds the length of the shortest pattern under the node
+ *
+ * @param nod
+ * @return the depth of the nearest final node, or (size_t)-1 if there is none
+ *****************************************************************************/
+static size_t prefilter_min_depth (ACT_NODE_t *nod)
+{
+    size_t i, depth, min = (size_t) -1;
+
+    if (nod->final)
+        return nod->depth;
+
+    for (i = 0; i < nod->outgoing_size; i++)
+    {
+        depth = prefilter_min_depth (nod->outgoing[i].next);
+        if (depth < min)
+            min = depth;
+    }
+
+    return min;
+}
+
+/**
+ * @brief The portable skip method: looks up every byte in the start table
+ *
+ * @param thiz
+ * @param text
+ * @param position
+ * @param length
+ * @return
+ *****************************************************************************/
+static size_t prefilter_skip_table (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length)
+{
+    const unsigned char *start = thiz->start;
+
+    while (position < length && !start[(unsigned char) text[position]])
+        position++;
+
+    return position;
+}
+
+/**
+ * @brief The portable skip method of the nibble tables
+ *
+ * Near the end of the text, the offsets beyond the text are considered to
+ * match, because the rest of the fingerprint may come in the next chunk.
+ *
+ * @param thiz
+ * @param text
+ * @param position
+ * @param length
+ * @return
+ *****************************************************************************/
+static size_t prefilter_skip_nibbles (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length)
+{
+    unsigned char mask, c;
+    size_t i;
+
+    for (; position < length; position++)
+    {
+        mask = 0xff;
+
+        for (i = 0; i < thiz->width && position + i < length && mask; i++)
+        {
+            c = (unsigned char) text[position + i];
+            mask &= thiz->lo_nibble[i][c & 0x0f] & thiz->hi_nibble[i][c >> 4];
+        }
+
+        if (mask)
+            break;
+    }
+
+    return position;
+}
+
+/**
+ * @brief The Wu-Manber skip method
+ *
+ * Slides a window as long as the shortest pattern over the text and shifts
+ * it by the shift of its last block. A window with a zero shift whose first
+ * block is a pattern prefix is a candidate.
+ *
+ * @param thiz
+ * @param text
+ * @param position
+ * @param length
+ * @return the start of the candidate window. If the window runs off the
+ * text, the start of the window, since the rest of the window may come in
+ * the next chunk.
+ *****************************************************************************/
+static size_t prefilter_skip_wumanber (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length)
+{
+    const unsigned char *wm_shift = thiz->wm_shift;
+    const unsigned char *wm_prefix = thiz->wm_prefix;
+    const AC_ALPHABET_t *xlat = thiz->xlat;
+    size_t m = thiz->wm_length;
+    size_t end = position + m - 1; /* The last byte of the window */
+    unsigned int block;
+    unsigned char shift;
+
+    while (end < length)
+    {
+        if (xlat)
+            block = PREFILTER_BLOCK (xlat[(unsigned char) text[end - 1]],
+                    xlat[(unsigned char) text[end]]);
+        else
+            block = PREFILTER_BLOCK (text[end - 1], text[end]);
+
+        if ((shift = wm_shift[block]))
+        {
+            end += shift;
+            continue;
+        }
+
+        /* The window may end at the end of a pattern prefix */
+        position = end + 1 - m;
+
+        if (xlat)
+            block = PREFILTER_BLOCK (xlat[(unsigned char) text[position]],
+                    xlat[(unsigned char) text[position + 1]]);
+        else
+            block = PREFILTER_BLOCK (text[position], text[position + 1]);
+
+        if (wm_prefix[block >> 3] & (1 << (block & 7)))
+            return position;
+
+        end++;
+    }
+
+    return end + 1 - m;
+}
+
+#ifdef PREFILTER_X86
+
+/**
+ * @brief Compares 16 bytes at a time with 2 or 3 start bytes
+ *
+ * @param thiz
+ * @param text
+ * @param position
+ * @param length
+ * @return
+ *****************************************************************************/
+__attribute__((target("sse2")))
+static size_t prefilter_skip_bytes_sse2 (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length)
+{
+    const __m128i b0 = _mm_set1_epi8 ((char) thiz->bytes[0]);
+    const __m128i b1 = _mm_set1_epi8 ((char) thiz->bytes[1]);
+    const __m128i b2 = _mm_set1_epi8 ((char) thiz->bytes
+            [thiz->start_count == 3 ? 2 : 1]);
+    __m128i v, eq;
+    unsigned int bits;
+
+    while (position + 16 <= length)
+    {
+        v = _mm_loadu_si128 ((const __m128i *) &text[position]);
+
+        eq = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (v, b0),
+                _mm_cmpeq_epi8 (v, b1)), _mm_cmpeq_epi8 (v, b2));
+
+        if ((bits = (unsigned int) _mm_movemask_epi8 (eq)))
+            return position + __builtin_ctz (bits);
+
+        position += 16;
+    }
+
+    return prefilter_skip_table (thiz, text, position, length);
+}
+
+/**
+ * @brief Looks up 16 positions at a time in the nibble tables using pshufb
+ *
+ * @param thiz
+ * @param text
+ * @param position
+ * @param length
+ * @return
+ *****************************************************************************/
+__attribute__((target("ssse3")))
+static size_t prefilter_skip_nibbles_ssse3 (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length)
+{
+    __m128i lo[AC_PREFILTER_MAX_WIDTH], hi[AC_PREFILTER_MAX_WIDTH];
+    const __m128i mask = _mm_set1_epi8 (0x0f);
+    const __m128i zero = _mm_setzero_si128 ();
+    __m128i v, r;
+    unsigned int bits;
+    size_t i, width = thiz->width;
+
+    for (i = 0; i < width; i++)
+    {
+        lo[i] = _mm_loadu_si128 ((const __m128i *) thiz->lo_nibble[i]);
+        hi[i] = _mm_loadu_si128 ((const __m128i *) thiz->hi_nibble[i]);
+    }
+
+    while (position + 15 + width <= length)
+    {
+        r = _mm_set1_epi8 ((char) 0xff);
+
+        for (i = 0; i < width; i++)
+        {
+            v = _mm_loadu_si128 ((const __m128i *) &text[position + i]);
+
+            r = _mm_and_si128 (r, _mm_and_si128 (
+                    _mm_shuffle_epi8 (lo[i], _mm_and_si128 (v, mask)),
+                    _mm_shuffle_epi8 (hi[i],
+                            _mm_and_si128 (_mm_srli_epi16 (v, 4), mask))));
+        }
+
+        bits = ~(unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi8 (r, zero))
+                & 0xffff;
+
+        if (bits)
+            return position + __builtin_ctz (bits);
+
+        position += 16;
+    }
+
+    return prefilter_skip_nibbles (thiz, text, position, length);
+}
+
+/**
+ * @brief Looks up 32 positions at a time in the nibble tables using vpshufb
+ *
+ * @param thiz
+ * @param text
+ * @param position
+ * @param length
+ * @return
+ *****************************************************************************/
+__attribute__((target("avx2")))
+static size_t prefilter_skip_nibbles_avx2 (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length)
+{
+    __m256i lo[AC_PREFILTER_MAX_WIDTH], hi[AC_PREFILTER_MAX_WIDTH];
+    const __m256i mask = _mm256_set1_epi8 (0x0f);
+    const __m256i zero = _mm256_setzero_si256 ();
+    __m256i v, r;
+    unsigned int bits;
+    size_t i, width = thiz->width;
+
+    /* vpshufb looks up each 128-bit lane separately */
+    for (i = 0; i < width; i++)
+    {
+        lo[i] = _mm256_broadcastsi128_si256
+                (_mm_loadu_si128 ((const __m128i *) thiz->lo_nibble[i]));
+        hi[i] = _mm256_broadcastsi128_si256
+                (_mm_loadu_si128 ((const __m128i *) thiz->hi_nibble[i]));
+    }
+
+    while (position + 31 + width <= length)
+    {
+        r = _mm256_set1_epi8 ((char) 0xff);
+
+        for (i = 0; i < width; i++)
+        {
+            v = _mm256_loadu_si256 ((const __m256i *) &text[position + i]);
+
+            r = _mm256_and_si256 (r, _mm256_and_si256 (
+                    _mm256_shuffle_epi8 (lo[i], _mm256_and_si256 (v, mask)),
+                    _mm256_shuffle_epi8 (hi[i], _mm256_and_si256
+                            (_mm256_srli_epi16 (v, 4), mask))));
+        }
+
+        bits = ~(unsigned int) _mm256_movemask_epi8
+                (_mm256_cmpeq_epi8 (r, zero));
+
+        if (bits)
+            return position + __builtin_ctz (bits);
+
+        position += 32;
+    }
+
+    return prefilter_skip_nibbles_ssse3 (thiz, text, position, length);
+}
+
+#endif
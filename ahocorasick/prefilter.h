@@ -0,0 +1,128 @@
+/*
+ * prefilter.h: Defines the root state prefilter of the trie
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PREFILTER_H_
+#define _PREFILTER_H_
+
+#include "actypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Forward declaration */
+struct ac_trie;
+
+/**
+ * Maximum number of start bytes for which the prefilter is used. With more
+ * start bytes the automaton rarely stays in the root long enough to win
+ * anything by skipping.
+ */
+#define AC_PREFILTER_MAX_BYTES 128
+
+/**
+ * Maximum number of patterns for which the Teddy method is used. Beyond
+ * this number the buckets get too crowded to filter anything.
+ */
+#define AC_PREFILTER_TEDDY_MAX_PATTERNS 64
+
+/**
+ * Maximum number of bytes in a Teddy fingerprint
+ */
+#define AC_PREFILTER_MAX_WIDTH 3
+
+/**
+ * The minimum pattern length for which Wu-Manber is chosen automatically
+ */
+#define AC_PREFILTER_WM_MIN_LENGTH 8
+
+/**
+ * Maximum length of the Wu-Manber window. The shifts are kept in bytes.
+ */
+#define AC_PREFILTER_WM_MAX_LENGTH 255
+
+/**
+ * Number of the entries of the Wu-Manber tables: one per block of 2 bytes
+ */
+#define AC_PREFILTER_BLOCKS 65536
+
+/**
+ * Different prefilter methods
+ */
+typedef enum ac_prefilter_type
+{
+    AC_PREFILTER_BYTES = 0, /**< Up to 3 start bytes: compare them directly */
+    AC_PREFILTER_NIBBLES,   /**< More start bytes: nibble table lookup */
+    AC_PREFILTER_TEDDY,     /**< Few patterns: nibble table lookup of the
+                             * first 2 or 3 bytes of the patterns */
+    AC_PREFILTER_WUMANBER   /**< Long patterns: Wu-Manber block shift */
+} AC_PREFILTER_TYPE_t;
+
+/**
+ * When the automaton is in the root node, only a few bytes (start bytes)
+ * can take it out of the root. The prefilter finds the next start byte in
+ * the input text so the bytes in between are skipped in bulk. With few
+ * patterns, the Teddy method finds the positions where the first 2 or 3
+ * bytes of some pattern may occur, which leaves far less candidates. If all
+ * the patterns are long, the Wu-Manber method slides a window over the text
+ * and skips up to the length of the shortest pattern at a time.
+ */
+typedef struct ac_prefilter
+{
+    AC_ENGINE_t engine;         /**< The search engine it implements */
+    AC_PREFILTER_TYPE_t type;   /**< The skip method */
+
+    unsigned char start[256];   /**< Is 1 for the bytes that leave the root */
+    size_t start_count;         /**< Number of start bytes */
+    unsigned char bytes[3];     /**< The start bytes, if they are at most 3 */
+
+    unsigned char lo_nibble[AC_PREFILTER_MAX_WIDTH][16];
+                    /**< Bucket masks indexed by byte offset and low nibble */
+    unsigned char hi_nibble[AC_PREFILTER_MAX_WIDTH][16];
+                    /**< Bucket masks indexed by byte offset and high nibble */
+    size_t width;   /**< Number of bytes looked up in the nibble tables */
+
+    int simd;   /**< Vectorized skip supported by the CPU: 0 none, 1 with
+                 * 16 bytes per step (SSE2/SSSE3), 2 with 32 bytes per step
+                 * (AVX2) */
+
+    size_t wm_length;           /**< Length of the Wu-Manber window */
+    unsigned char *wm_shift;    /**< Shift of the window by its last block */
+    unsigned char *wm_prefix;   /**< Bitmap of the first blocks of the
+                                 * patterns */
+    const AC_ALPHABET_t *xlat;  /**< Translation table of the trie */
+
+} AC_PREFILTER_t;
+
+/*
+ * Prefilter interface functions
+ */
+
+AC_PREFILTER_t *prefilter_create (struct ac_trie *trie, AC_ENGINE_t engine);
+void   prefilter_release (AC_PREFILTER_t *thiz);
+size_t prefilter_size (AC_PREFILTER_t *thiz);
+size_t prefilter_skip (AC_PREFILTER_t *thiz,
+        const AC_ALPHABET_t *text, size_t position, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
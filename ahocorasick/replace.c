@@ -23,6 +23,7 @@
 
 #include "node.h"
 #include "ahocorasick.h"
+#include "prefilter.h"
 
 
 /* Privates */
@@ -33,33 +34,70 @@ static void mf_repdata_do_replace
 static void mf_repdata_booknominee 
     (MF_REPLACEMENT_DATA_t *rd, struct mf_replacement_nominee *new_nom);
 
-static void mf_repdata_push_nominee 
-    (MF_REPLACEMENT_DATA_t *rd, struct mf_replacement_nominee *new_nom);
+static struct mf_replacement_nominee *mf_repdata_nominee 
+    (MF_REPLACEMENT_DATA_t *rd, size_t index);
 
 static void mf_repdata_grow_noms_array 
     (MF_REPLACEMENT_DATA_t *rd);
 
+static int mf_repdata_replace 
+    (AC_TRIE_t *thiz, AC_TEXT_t *instr, MF_REPLACE_MODE_t mode);
+
 static void mf_repdata_appendtext 
     (MF_REPLACEMENT_DATA_t *rd, AC_TEXT_t *text);
 
+static void mf_repdata_appendsegment 
+    (MF_REPLACEMENT_DATA_t *rd, AC_TEXT_t *text);
+
 static void mf_repdata_appendfactor 
     (MF_REPLACEMENT_DATA_t *rd, size_t from, size_t to);
 
+static void mf_repdata_appendbacklog 
+    (MF_REPLACEMENT_DATA_t *rd, size_t from, size_t to);
+
 static void mf_repdata_savetobacklog 
     (MF_REPLACEMENT_DATA_t *rd, size_t to_position_r);
 
 static void mf_repdata_flush 
     (MF_REPLACEMENT_DATA_t *rd);
 
+static void mf_repdata_passtext 
+    (MF_REPLACEMENT_DATA_t *rd, AC_TEXT_t *text);
+
 static unsigned int mf_repdata_bookreplacements 
     (ACT_NODE_t *node);
 
+static int mf_repdata_output_reserve 
+    (MF_OUTPUT_t *output, size_t size);
+
+static void mf_repdata_output_listener 
+    (const AC_TEXT_t *segments, size_t count, void *user);
+
 /* Publics */
 
 void mf_repdata_init (AC_TRIE_t *trie);
 void mf_repdata_reset (MF_REPLACEMENT_DATA_t *rd);
 void mf_repdata_release (MF_REPLACEMENT_DATA_t *rd);
 void mf_repdata_allocbuf (MF_REPLACEMENT_DATA_t *rd);
+void mf_repdata_push_nominee 
+    (MF_REPLACEMENT_DATA_t *rd, struct mf_replacement_nominee *new_nom);
+AC_PATTERN_t *mf_repdata_pickpattern 
+    (AC_TRIE_t *thiz, ACT_NODE_t *node, size_t position, int eot);
+AC_PATTERN_t *mf_repdata_pickpattern_text (AC_TRIE_t *thiz, ACT_NODE_t *node, 
+        const AC_TEXT_t *text, size_t offset, size_t position, int eot);
+
+/* Friends */
+
+extern void ac_trie_reset (AC_TRIE_t *thiz);
+#ifdef AC_COUNTERS
+extern void ac_trie_count_hit 
+    (AC_TRIE_t *thiz, ACT_NODE_t *node, AC_PATTERN_t *patt);
+extern unsigned long long ac_trie_clock (void);
+#endif
+extern int  ac_trie_check_text (AC_TRIE_t *thiz, AC_PATTERN_t *patt, 
+        const AC_TEXT_t *text, size_t offset, size_t position, int eot);
+extern void ac_trie_keep_history 
+    (AC_TRIE_t *thiz, AC_TEXT_t *text, size_t depth);
 
 
 /**
@@ -73,16 +111,24 @@ void mf_repdata_init (AC_TRIE_t *trie)
     
     rd->buffer.astring = NULL;
     rd->buffer.length = 0;
+    rd->buffer_size = MF_REPLACEMENT_BUFFER_SIZE;
+    rd->segments = NULL;
+    rd->segments_size = 0;
     rd->backlog.astring = NULL;
     rd->backlog.length = 0;
+    rd->backlog_head = 0;
     rd->has_replacement = 0;
+    rd->expands = 0;
     rd->curser = 0;
     
     rd->noms = NULL;
     rd->noms_capacity = 0;
+    rd->noms_head = 0;
     rd->noms_size = 0;
     
     rd->replace_mode = MF_REPLACE_MODE_DEFAULT;
+    rd->cbf = NULL;
+    rd->scbf = NULL;
     rd->trie = trie;
 }
 
@@ -94,17 +140,44 @@ void mf_repdata_init (AC_TRIE_t *trie)
  *****************************************************************************/
 void mf_repdata_allocbuf (MF_REPLACEMENT_DATA_t *rd)
 {    
+    ACT_NODE_t *node;
+    AC_PATTERN_t *pattern;
+    size_t i, j;
+    
     /* Bookmark replacement pattern for faster retrieval */
     rd->has_replacement = mf_repdata_bookreplacements (rd->trie->root);
     
+    /* Any pattern with a replacement may be picked by the boundary checks, 
+     * not only the bookmarked ones */
+    for (i = 0; i < rd->trie->nodes_count; i++)
+    {
+        node = rd->trie->nodes[i];
+        
+        for (j = 0; j < node->matched_size; j++)
+        {
+            pattern = &node->matched[j];
+            
+            if (pattern->rtext.astring && 
+                    pattern->rtext.length > pattern->ptext.length)
+                rd->expands = 1;
+        }
+    }
+    
     if (rd->has_replacement)
     {
         rd->buffer.astring = (AC_ALPHABET_t *) 
-                malloc (MF_REPLACEMENT_BUFFER_SIZE * sizeof(AC_ALPHABET_t));
+                malloc (rd->buffer_size * sizeof(AC_ALPHABET_t));
         
         rd->backlog.astring = (AC_ALPHABET_t *) 
                 malloc (AC_PATTRN_MAX_LENGTH * sizeof(AC_ALPHABET_t));
         
+        rd->segments = (AC_TEXT_t *) 
+                malloc (MF_REPLACEMENT_SEGMENTS * sizeof(AC_TEXT_t));
+        
+        rd->trie->vectors_size += (rd->buffer_size + 
+                AC_PATTRN_MAX_LENGTH) * sizeof(AC_ALPHABET_t) + 
+                MF_REPLACEMENT_SEGMENTS * sizeof(AC_TEXT_t);
+        
         /* Backlog length is not bigger than the max pattern length */
     }
 }
@@ -139,8 +212,11 @@ static unsigned int mf_repdata_bookreplacements (ACT_NODE_t *node)
 void mf_repdata_reset (MF_REPLACEMENT_DATA_t *rd)
 {    
     rd->buffer.length = 0;
+    rd->segments_size = 0;
     rd->backlog.length = 0;
+    rd->backlog_head = 0;
     rd->curser = 0;
+    rd->noms_head = 0;
     rd->noms_size = 0;
 }
 
@@ -153,6 +229,7 @@ void mf_repdata_release (MF_REPLACEMENT_DATA_t *rd)
 {    
     free((AC_ALPHABET_t *)rd->buffer.astring);
     free((AC_ALPHABET_t *)rd->backlog.astring);
+    free(rd->segments);
     free(rd->noms);
 }
 
@@ -163,51 +240,106 @@ void mf_repdata_release (MF_REPLACEMENT_DATA_t *rd)
  *****************************************************************************/
 static void mf_repdata_flush (MF_REPLACEMENT_DATA_t *rd)
 {    
-    rd->cbf(&rd->buffer, rd->user);
+    if (rd->scbf && rd->segments_size == 0)
+        return; /* Nothing to pass */
+    
+    AC_COUNT (rd->trie->counters.callbacks++; 
+            rd->trie->counters.callback_ns -= ac_trie_clock ());
+    
+    if (rd->scbf)
+        rd->scbf(rd->segments, rd->segments_size, rd->user);
+    else
+        rd->cbf(&rd->buffer, rd->user);
+    
+    AC_COUNT (rd->trie->counters.callback_ns += ac_trie_clock ());
+    
     rd->buffer.length = 0;
+    rd->segments_size = 0;
 }
 
 /**
- * @brief Extends the nominees array
+ * @brief Passes a text to the user directly, bypassing the buffer
+ * 
+ * @param rd
+ * @param text
+ *****************************************************************************/
+static void mf_repdata_passtext (MF_REPLACEMENT_DATA_t *rd, AC_TEXT_t *text)
+{
+    AC_TEXT_t direct = *text; /* The text may be a replacement text, which 
+                               * the call-back must not change */
+    
+    AC_COUNT (rd->trie->counters.callbacks++; 
+            rd->trie->counters.callback_ns -= ac_trie_clock ());
+    
+    rd->cbf(&direct, rd->user);
+    
+    AC_COUNT (rd->trie->counters.callback_ns += ac_trie_clock ());
+}
+
+/**
+ * @brief Returns a nominee of the queue
+ * 
+ * @param rd
+ * @param index the index of the nominee from the head of the queue
+ * @return 
+ *****************************************************************************/
+static struct mf_replacement_nominee *mf_repdata_nominee 
+    (MF_REPLACEMENT_DATA_t *rd, size_t index)
+{
+    return &rd->noms[(rd->noms_head + index) & (rd->noms_capacity - 1)];
+}
+
+/**
+ * @brief Doubles the capacity of the nominee queue
  * 
  * @param rd
  *****************************************************************************/
 static void mf_repdata_grow_noms_array (MF_REPLACEMENT_DATA_t *rd)
 {
-    const size_t grow_factor = 128;
+    const size_t initial_capacity = 128; /* Must be a power of 2 */
+    size_t old_capacity = rd->noms_capacity;
     
-    if (rd->noms_capacity == 0)
+    if (old_capacity == 0)
     {
-        rd->noms_capacity = grow_factor;
+        rd->noms_capacity = initial_capacity;
         rd->noms = (struct mf_replacement_nominee *) malloc 
                 (rd->noms_capacity * sizeof(struct mf_replacement_nominee));
+        rd->noms_head = 0;
         rd->noms_size = 0;
     }
     else
     {
-        rd->noms_capacity += grow_factor;
+        rd->noms_capacity *= 2;
         rd->noms = (struct mf_replacement_nominee *) realloc (rd->noms, 
                 rd->noms_capacity * sizeof(struct mf_replacement_nominee));
+        
+        /* The queue is full, so it wraps around unless its head is at the 
+         * start; move the wrapped part after the old end */
+        memcpy (&rd->noms[old_capacity], &rd->noms[0], 
+                rd->noms_head * sizeof(struct mf_replacement_nominee));
     }
+    
+    rd->trie->vectors_size += (rd->noms_capacity - old_capacity) * 
+            sizeof(struct mf_replacement_nominee);
 }
 
 /**
- * @brief Adds the nominee to the end of the nominee list
+ * @brief Adds the nominee to the end of the nominee queue
  * 
  * @param rd
  * @param new_nom
  *****************************************************************************/
-static void mf_repdata_push_nominee 
+void mf_repdata_push_nominee 
     (MF_REPLACEMENT_DATA_t *rd, struct mf_replacement_nominee *new_nom)
 {
     struct mf_replacement_nominee *nomp;
     
-    /* Extend the vector if needed */
+    /* Extend the queue if needed */
     if (rd->noms_size == rd->noms_capacity)
         mf_repdata_grow_noms_array (rd);
     
     /* Add the new nominee to the end */
-    nomp = &rd->noms[rd->noms_size];
+    nomp = mf_repdata_nominee (rd, rd->noms_size);
     nomp->pattern = new_nom->pattern;
     nomp->position = new_nom->position;
     rd->noms_size ++;
@@ -240,7 +372,7 @@ static void mf_repdata_booknominee (MF_REPLACEMENT_DATA_t *rd,
             
             if (rd->noms_size > 0)
             {
-                prev_nom = &rd->noms[rd->noms_size - 1];
+                prev_nom = mf_repdata_nominee (rd, rd->noms_size - 1);
                 prev_end_pos = prev_nom->position;
 
                 if (new_start_pos < prev_end_pos)
@@ -254,7 +386,7 @@ static void mf_repdata_booknominee (MF_REPLACEMENT_DATA_t *rd,
             
             while (rd->noms_size > 0)
             {
-                prev_nom = &rd->noms[rd->noms_size - 1];
+                prev_nom = mf_repdata_nominee (rd, rd->noms_size - 1);
                 prev_start_pos = 
                         prev_nom->position - prev_nom->pattern->ptext.length;
                 prev_end_pos = prev_nom->position;
@@ -271,6 +403,60 @@ static void mf_repdata_booknominee (MF_REPLACEMENT_DATA_t *rd,
     mf_repdata_push_nominee(rd, new_nom);
 }
 
+/**
+ * @brief Picks the to-be-replaced pattern of a node which has patterns with
+ * boundary flags: the longest pattern that passes the checks and has a 
+ * requested replacement.
+ * 
+ * @param thiz
+ * @param node
+ * @param position the end position of the match in the whole input
+ * @param eot indicates that the match is at the end of the input text
+ * @return 
+ *****************************************************************************/
+AC_PATTERN_t *mf_repdata_pickpattern 
+    (AC_TRIE_t *thiz, ACT_NODE_t *node, size_t position, int eot)
+{
+    return mf_repdata_pickpattern_text (thiz, node, thiz->text, 
+            thiz->base_position, position, eot);
+}
+
+/**
+ * @brief Picks the to-be-replaced pattern like mf_repdata_pickpattern(), 
+ * with the boundary checks made in the given chunk; it only reads the trie.
+ * 
+ * @param thiz
+ * @param node
+ * @param text the chunk
+ * @param offset the position of the chunk in the whole input
+ * @param position the end position of the match in the whole input
+ * @param eot indicates that the match is at the end of the input text
+ * @return 
+ *****************************************************************************/
+AC_PATTERN_t *mf_repdata_pickpattern_text (AC_TRIE_t *thiz, ACT_NODE_t *node, 
+        const AC_TEXT_t *text, size_t offset, size_t position, int eot)
+{
+    size_t j;
+    AC_PATTERN_t *pattern;
+    AC_PATTERN_t *longest = NULL;
+    
+    for (j = 0; j < node->matched_size; j++)
+    {
+        pattern = &node->matched[j];
+        
+        if (pattern->rtext.astring == NULL)
+            continue;
+        
+        if (longest && pattern->ptext.length <= longest->ptext.length)
+            continue;
+        
+        if (ac_trie_check_text (thiz, pattern, text, offset, position, eot))
+            longest = pattern;
+    }
+    
+    return longest;
+}
+
 /**
  * @brief Append the given text to the output buffer
  * 
@@ -284,9 +470,26 @@ static void mf_repdata_appendtext (MF_REPLACEMENT_DATA_t *rd, AC_TEXT_t *text)
     size_t copy_len = 0;
     size_t copy_index = 0;
     
+    if (rd->scbf)
+    {
+        mf_repdata_appendsegment (rd, text);
+        return;
+    }
+    
+    if (text->length >= rd->buffer_size)
+    {
+        /* Copying a text as big as the buffer gains nothing; pass it to the 
+         * user as it is, after what is already in the buffer */
+        if (rd->buffer.length)
+            mf_repdata_flush (rd);
+        
+        mf_repdata_passtext (rd, text);
+        return;
+    }
+    
     while (copy_index < text->length)
     {
-        remaining_bufspace = MF_REPLACEMENT_BUFFER_SIZE - rd->buffer.length;
+        remaining_bufspace = rd->buffer_size - rd->buffer.length;
         remaining_text = text->length - copy_index;
         
         copy_len = (remaining_bufspace >= remaining_text)? 
@@ -299,11 +502,47 @@ static void mf_repdata_appendtext (MF_REPLACEMENT_DATA_t *rd, AC_TEXT_t *text)
         rd->buffer.length += copy_len;
         copy_index += copy_len;
         
-        if (rd->buffer.length == MF_REPLACEMENT_BUFFER_SIZE)
+        if (rd->buffer.length == rd->buffer_size)
             mf_repdata_flush(rd);
     }
 }
 
+/**
+ * @brief Append the given text to the output segments, without copying it.
+ * 
+ * The text must stay valid until the segments are passed to the user, which 
+ * is done before the replacement functions return and before the backlog 
+ * changes.
+ * 
+ * @param rd
+ * @param text
+ *****************************************************************************/
+static void mf_repdata_appendsegment 
+    (MF_REPLACEMENT_DATA_t *rd, AC_TEXT_t *text)
+{
+    AC_TEXT_t *last;
+    
+    if (text->length == 0)
+        return;
+    
+    if (rd->segments_size)
+    {
+        last = &rd->segments[rd->segments_size - 1];
+        
+        if (last->astring + last->length == text->astring)
+        {
+            /* The text continues the last segment */
+            last->length += text->length;
+            return;
+        }
+    }
+    
+    if (rd->segments_size == MF_REPLACEMENT_SEGMENTS)
+        mf_repdata_flush (rd);
+    
+    rd->segments[rd->segments_size++] = *text;
+}
+
 /**
  * @brief Append a factor of the current text to the output buffer
  *  
@@ -319,8 +558,8 @@ static void mf_repdata_appendfactor
     size_t backlog_base_pos;
     size_t base_position = rd->trie->base_position;
     
-    if (to < from)
-        return;
+    if (to <= from)
+        return; /* Do not touch the input text, which is gone at the flush */
     
     if (base_position <= from)
     {
@@ -335,21 +574,19 @@ static void mf_repdata_appendfactor
         if (from < backlog_base_pos)
             return; /* shouldn't come here */
         
-        if (to < base_position)
+        if (to <= base_position)
         {
             /* The backlog located in the backlog part */
-            factor.astring = &rd->backlog.astring[from - backlog_base_pos];
-            factor.length = to - from;
-            mf_repdata_appendtext (rd, &factor);
+            mf_repdata_appendbacklog (rd, from - backlog_base_pos, 
+                    to - backlog_base_pos);
         }
         else
         {
             /* The factor is divided between backlog and input text */
             
             /* The backlog part */
-            factor.astring = &rd->backlog.astring[from - backlog_base_pos];
-            factor.length = rd->backlog.length - from + backlog_base_pos;
-            mf_repdata_appendtext (rd, &factor);
+            mf_repdata_appendbacklog (rd, from - backlog_base_pos, 
+                    rd->backlog.length);
             
             /* The input text part */
             factor.astring = instr->astring;
@@ -359,6 +596,38 @@ static void mf_repdata_appendfactor
     }
 }
 
+/**
+ * @brief Append a part of the backlog to the output buffer. The backlog 
+ * buffer is circular, so the part may wrap around its end.
+ * 
+ * @param rd
+ * @param from the start of the part, relative to the start of the backlog
+ * @param to the end of the part, relative to the start of the backlog
+ *****************************************************************************/
+static void mf_repdata_appendbacklog 
+    (MF_REPLACEMENT_DATA_t *rd, size_t from, size_t to)
+{
+    AC_TEXT_t factor;
+    size_t start = (rd->backlog_head + from) % AC_PATTRN_MAX_LENGTH;
+    size_t length = to - from;
+    
+    factor.astring = &rd->backlog.astring[start];
+    factor.length = length;
+    
+    if (start + length > AC_PATTRN_MAX_LENGTH)
+    {
+        /* The part before the end of the buffer */
+        factor.length = AC_PATTRN_MAX_LENGTH - start;
+        mf_repdata_appendtext (rd, &factor);
+        
+        /* The part at the start of the buffer */
+        factor.astring = rd->backlog.astring;
+        factor.length = length - factor.length;
+    }
+    
+    mf_repdata_appendtext (rd, &factor);
+}
+
 /**
  * @brief Saves the backlog part of the current text to the backlog buffer. The
  * backlog part is the part after @p bg_pos
@@ -371,6 +640,7 @@ static void mf_repdata_savetobacklog (MF_REPLACEMENT_DATA_t *rd, size_t bg_pos)
     size_t bg_pos_r; /* relative backlog position */
     AC_TEXT_t *instr = rd->trie->text;
     size_t base_position = rd->trie->base_position;
+    size_t tail, length, first;
     
     if (base_position < bg_pos)
         bg_pos_r = bg_pos - base_position;
@@ -383,13 +653,20 @@ static void mf_repdata_savetobacklog (MF_REPLACEMENT_DATA_t *rd, size_t bg_pos)
     if (instr->length < bg_pos_r)
         return; /* unexpected : assert (instr->length >= bg_pos_r) */
     
-    /* Copy the part after bg_pos_r to the backlog buffer */
-    memcpy( (AC_ALPHABET_t *)
-            &rd->backlog.astring[rd->backlog.length], 
-            &instr->astring[bg_pos_r], 
-            instr->length - bg_pos_r );
-
-    rd->backlog.length += instr->length - bg_pos_r;
+    /* Copy the part after bg_pos_r to the end of the backlog, which may 
+     * wrap around the end of the circular buffer */
+    tail = (rd->backlog_head + rd->backlog.length) % AC_PATTRN_MAX_LENGTH;
+    length = instr->length - bg_pos_r;
+    first = (tail + length > AC_PATTRN_MAX_LENGTH) ? 
+            AC_PATTRN_MAX_LENGTH - tail : length;
+    
+    memcpy ((AC_ALPHABET_t *) &rd->backlog.astring[tail], 
+            &instr->astring[bg_pos_r], first * sizeof(AC_ALPHABET_t));
+    memcpy ((AC_ALPHABET_t *) rd->backlog.astring, 
+            &instr->astring[bg_pos_r + first], 
+            (length - first) * sizeof(AC_ALPHABET_t));
+    
+    rd->backlog.length += length;
 }
 
 /**
@@ -403,19 +680,20 @@ static void mf_repdata_savetobacklog (MF_REPLACEMENT_DATA_t *rd, size_t bg_pos)
 static void mf_repdata_do_replace 
     (MF_REPLACEMENT_DATA_t *rd, size_t to_position)
 {
-    unsigned int index;
+    size_t index;
     struct mf_replacement_nominee *nom;
     size_t base_position = rd->trie->base_position;
+    size_t consumed;
     
-    if (to_position < base_position)
-        return;
+    /* The to_position may be in the backlog, when the current node is deeper
+     * than the current chunk is long */
     
     /* Replace the candidate patterns */
     if (rd->noms_size > 0)
     {
         for (index = 0; index < rd->noms_size; index++)
         {
-            nom = &rd->noms[index];
+            nom = mf_repdata_nominee (rd, index);
             
             if (to_position <= (nom->position - nom->pattern->ptext.length))
                 break;
@@ -429,15 +707,10 @@ static void mf_repdata_do_replace
             
             rd->curser = nom->position;
         }
-        rd->noms_size -= index;
         
-        /* Shift the array to the left to eliminate the consumed nominees */
-        if (rd->noms_size && index)
-        {
-            memcpy (&rd->noms[0], &rd->noms[index], 
-                    rd->noms_size * sizeof(struct mf_replacement_nominee));
-            /* TODO: implement a circular queue */
-        }
+        /* Pop the consumed nominees off the head of the queue */
+        rd->noms_head = (rd->noms_head + index) & (rd->noms_capacity - 1);
+        rd->noms_size -= index;
     }
     
     /* Append the chunk between the last pattern and to_position */
@@ -448,10 +721,24 @@ static void mf_repdata_do_replace
         rd->curser = to_position;
     }
     
+    /* The segments may refer to the backlog and to the input text */
+    if (rd->scbf)
+        mf_repdata_flush (rd);
+    
     if (base_position <= rd->curser)
     {
-        /* we consume the whole backlog or none of it */
+        /* The whole backlog is consumed */
         rd->backlog.length = 0;
+        rd->backlog_head = 0;
+    }
+    else if (base_position - rd->curser < rd->backlog.length)
+    {
+        /* Drop the consumed head of the backlog, so that it does not grow 
+         * beyond the depth of the current node */
+        consumed = rd->backlog.length - (base_position - rd->curser);
+        rd->backlog_head = 
+                (rd->backlog_head + consumed) % AC_PATTRN_MAX_LENGTH;
+        rd->backlog.length -= consumed;
     }
 }
 
@@ -468,11 +755,193 @@ static void mf_repdata_do_replace
  *****************************************************************************/
 int multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *instr, 
         MF_REPLACE_MODE_t mode, MF_REPLACE_CALBACK_f callback, void *param)
+{
+    MF_REPLACEMENT_DATA_t *rd = &thiz->repdata;
+    
+    rd->cbf = callback;
+    rd->scbf = NULL;
+    rd->user = param;
+    
+    return mf_repdata_replace (thiz, instr, mode);
+}
+
+/**
+ * @brief Same as multifast_replace(), but the result is not copied to the 
+ * replacement buffer: it is passed to the call-back function as a vector of 
+ * segments that point to the input text, to the replacement texts, and to 
+ * the backlog of the trie, e.g. to be written with writev(). 
+ * 
+ * The segments are only valid during the call-back. They are passed before 
+ * the function returns, so the call-back may be called several times for one 
+ * input text, with up to MF_REPLACEMENT_SEGMENTS segments at a time; it is 
+ * not called when there is no output.
+ * 
+ * @param thiz
+ * @param instr
+ * @param mode
+ * @param callback
+ * @param param
+ * @return 
+ *****************************************************************************/
+int multifast_replacev (AC_TRIE_t *thiz, AC_TEXT_t *instr, 
+        MF_REPLACE_MODE_t mode, MF_REPLACE_SEGMENTS_CALBACK_f callback, 
+        void *param)
+{
+    MF_REPLACEMENT_DATA_t *rd = &thiz->repdata;
+    
+    if (rd->buffer.length)
+        mf_repdata_flush (rd); /* The output of multifast_replace() */
+    
+    rd->scbf = callback;
+    rd->user = param;
+    
+    return mf_repdata_replace (thiz, instr, mode);
+}
+
+/**
+ * @brief Replaces the patterns in the given text and writes the result to 
+ * the output buffer, with no call-back function. The text is a whole input: 
+ * a new stream is started, and it is ended with the text.
+ * 
+ * The output is written to output->astring, of output->capacity bytes, and 
+ * its length is set to output->length. If output->growable is set, the 
+ * buffer is malloc'd (or NULL) and it is realloc'd as needed; it is sized to 
+ * the length of the text up front, which is the exact upper bound when no 
+ * replacement is longer than its pattern, so the output takes at most one 
+ * allocation in that case. The caller frees the buffer.
+ * 
+ * If the buffer is not growable and the output does not fit in it, the 
+ * function returns -3, and output->length is set to the length that the 
+ * output needs.
+ * 
+ * @param thiz
+ * @param instr
+ * @param mode
+ * @param output
+ * @return 0 on success, -1 if the trie is open, -3 if the output does not 
+ * fit in the buffer, -4 if the buffer could not be grown
+ *****************************************************************************/
+int multifast_replace_tobuffer (AC_TRIE_t *thiz, AC_TEXT_t *instr, 
+        MF_REPLACE_MODE_t mode, MF_OUTPUT_t *output)
+{
+    MF_REPLACEMENT_DATA_t *rd = &thiz->repdata;
+    
+    if (thiz->trie_open)
+        return -1; /* _finalize() must be called first */
+    
+    output->length = 0;
+    
+    if (output->growable)
+        mf_repdata_output_reserve (output, instr->length);
+    
+    if (!rd->has_replacement)
+    {
+        /* The output is the text itself */
+        mf_repdata_output_listener (instr, 1, output);
+    }
+    else
+    {
+        ac_trie_reset (thiz);
+        
+        rd->scbf = mf_repdata_output_listener;
+        rd->user = output;
+        
+        mf_repdata_replace (thiz, instr, mode);
+        multifast_rep_flush (thiz, 0);
+        
+        rd->scbf = NULL;
+    }
+    
+    if (output->length > output->capacity)
+        return output->growable ? -4 : -3;
+    
+    return 0;
+}
+
+/**
+ * @brief Replaces the patterns in the given text in place, in lazy mode: the 
+ * result is written over the text, e.g. a writable mmap'd file, in a single 
+ * forward pass, and text->length is set to its length. The text is a whole 
+ * input: a new stream is started, and it is ended with the text.
+ * 
+ * It is only possible when no replacement is longer than its pattern, which 
+ * is found out by ac_trie_finalize(). The lazy mode drops the nominees that 
+ * overlap, so the output of a part of the input is never longer than that 
+ * part; the normal mode replaces every overlapping nominee, and could pass 
+ * the input. The output of every window of the text is written behind the 
+ * window, while the bytes that the trie still needs are kept in the history 
+ * and the backlog.
+ * 
+ * @param thiz
+ * @param text the text; its bytes are written
+ * @return 0 on success, -1 if the trie is open, -3 if a replacement is longer
+ * than its pattern
+ *****************************************************************************/
+int multifast_replace_inplace (AC_TRIE_t *thiz, AC_TEXT_t *text)
+{
+    MF_REPLACEMENT_DATA_t *rd = &thiz->repdata;
+    MF_OUTPUT_t output;
+    AC_TEXT_t window;
+    size_t offset = 0;
+    
+    if (thiz->trie_open)
+        return -1; /* _finalize() must be called first */
+    
+    if (rd->expands)
+        return -3; /* The output may not fit in the text */
+    
+    if (!rd->has_replacement)
+        return 0; /* The text is the output */
+    
+    output.astring = (AC_ALPHABET_t *) text->astring;
+    output.length = 0;
+    output.capacity = text->length;
+    output.growable = 0;
+    
+    ac_trie_reset (thiz);
+    
+    rd->scbf = mf_repdata_output_listener;
+    rd->user = &output;
+    
+    /* The windows bound the nominees that are held at a time */
+    while (offset < text->length)
+    {
+        window.astring = text->astring + offset;
+        window.length = text->length - offset;
+        if (window.length > MF_REPLACEMENT_WINDOW)
+            window.length = MF_REPLACEMENT_WINDOW;
+        
+        mf_repdata_replace (thiz, &window, MF_REPLACE_MODE_LAZY);
+        offset += window.length;
+    }
+    multifast_rep_flush (thiz, 0);
+    
+    rd->scbf = NULL;
+    
+    text->length = output.length;
+    
+    return 0;
+}
+
+/**
+ * @brief Runs the replacement over the given text; the call-back functions 
+ * are set by the caller
+ * 
+ * @param thiz
+ * @param instr
+ * @param mode
+ * @return 
+ *****************************************************************************/
+static int mf_repdata_replace (AC_TRIE_t *thiz, AC_TEXT_t *instr, 
+        MF_REPLACE_MODE_t mode)
 {
     ACT_NODE_t *current;
     ACT_NODE_t *next;
     struct mf_replacement_nominee nom;
     MF_REPLACEMENT_DATA_t *rd = &thiz->repdata;
+    AC_ALPHABET_t alpha;
+    const AC_ALPHABET_t *xlat = thiz->xlat;
+    AC_PREFILTER_t *prefilter = thiz->prefilter;
     
     size_t position_r = 0;  /* Relative current position in the input string */
     size_t backlog_pos = 0; /* Relative backlog position in the input string */
@@ -483,8 +952,6 @@ int multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *instr,
     if (!rd->has_replacement)
         return -2; /* Trie doesn't have any to-be-replaced pattern */
     
-    rd->cbf = callback;
-    rd->user = param;
     rd->replace_mode = mode;
     
     thiz->text = instr; /* Save the input string in a helper variable 
@@ -492,23 +959,65 @@ int multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *instr,
     
     current = thiz->last_node;
     
+    if (thiz->pending_node && instr->length)
+    {
+        /* Decide about the nominee that was held back at the end of the 
+         * previous chunk */
+        nom.pattern = mf_repdata_pickpattern 
+                (thiz, thiz->pending_node, thiz->base_position, 0);
+        nom.position = thiz->base_position;
+        
+        AC_COUNT (if (nom.pattern) {
+                ac_trie_count_hit (thiz, thiz->pending_node, nom.pattern);
+                thiz->counters.matches++; });
+        
+        thiz->pending_node = NULL;
+        
+        mf_repdata_booknominee (rd, &nom);
+    }
+    
     /* Main replace loop: 
      * Find patterns and bookmark them 
      */
     while (position_r < instr->length)
     {
-        if (!(next = node_find_next_bs(current, instr->astring[position_r])))
+        if (prefilter && current == thiz->root && 
+                !prefilter->start[(unsigned char) instr->astring[position_r]])
+        {
+            /* Skip the bytes that keep us in the root node */
+            AC_COUNT (thiz->counters.skipped -= position_r; 
+                    thiz->counters.bytes -= position_r);
+            position_r = prefilter_skip (prefilter, instr->astring, 
+                    position_r, instr->length);
+            AC_COUNT (thiz->counters.skipped += position_r; 
+                    thiz->counters.bytes += position_r);
+            if (position_r == instr->length)
+                break;
+        }
+        
+        alpha = instr->astring[position_r];
+        if (xlat)
+            alpha = xlat[(unsigned char) alpha];
+        
+        if (!(next = node_find_next_bs(current, alpha)))
         {
             /* Failed to follow a pattern */
             if(current->failure_node)
+            {
                 current = current->failure_node;
+                AC_COUNT (thiz->counters.failures++);
+            }
             else
+            {
                 position_r++;
+                AC_COUNT (thiz->counters.bytes++);
+            }
         }
         else
         {
             current = next;
             position_r++;
+            AC_COUNT (thiz->counters.gotos++; thiz->counters.bytes++);
         }
         
         if (current->final && next)
@@ -517,6 +1026,24 @@ int multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *instr,
             nom.pattern = current->to_be_replaced;
             nom.position = thiz->base_position + position_r;
             
+            if (current->matched_checks && nom.pattern)
+            {
+                if ((current->matched_checks & AC_PATTFLAG_LOOKAHEAD) && 
+                        position_r == instr->length)
+                {
+                    /* The byte after the match is in the next chunk */
+                    thiz->pending_node = current;
+                    continue;
+                }
+                
+                nom.pattern = mf_repdata_pickpattern 
+                        (thiz, current, nom.position, 0);
+            }
+            
+            AC_COUNT (if (nom.pattern) {
+                    ac_trie_count_hit (thiz, current, nom.pattern);
+                    thiz->counters.matches++; });
+            
             mf_repdata_booknominee (rd, &nom);
         }
     }
@@ -528,6 +1055,10 @@ int multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *instr,
     
     backlog_pos = thiz->base_position + instr->length - current->depth;
     
+    /* Keep the history before the output is passed: it may be written over 
+     * the input; see multifast_replace_inplace() */
+    ac_trie_keep_history (thiz, instr, current->depth);
+    
     /* Now replace the patterns up to the backlog_pos point */
     mf_repdata_do_replace (rd, backlog_pos);
     
@@ -552,17 +1083,95 @@ int multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *instr,
  *****************************************************************************/
 void multifast_rep_flush (AC_TRIE_t *thiz, int keep)
 {
+    struct mf_replacement_nominee nom;
+    
+    if (!thiz->repdata.has_replacement)
+        return; /* Nothing was replaced; see multifast_replace() */
+    
     if (!keep)
     {
+        if (thiz->pending_node)
+        {
+            /* The held back nominee is at the end of the input */
+            nom.pattern = mf_repdata_pickpattern 
+                    (thiz, thiz->pending_node, thiz->base_position, 1);
+            nom.position = thiz->base_position;
+            
+            AC_COUNT (if (nom.pattern) {
+                    ac_trie_count_hit (thiz, thiz->pending_node, nom.pattern);
+                    thiz->counters.matches++; });
+            
+            thiz->pending_node = NULL;
+            
+            mf_repdata_booknominee (&thiz->repdata, &nom);
+        }
+        
         mf_repdata_do_replace (&thiz->repdata, thiz->base_position);
     }
     
     mf_repdata_flush (&thiz->repdata);
     
     if (!keep)
+        ac_trie_reset (thiz);
+}
+
+/**
+ * @brief Makes room for the given size in the output buffer
+ * 
+ * @param output
+ * @param size
+ * @return 1 if the buffer has the room, 0 otherwise
+ *****************************************************************************/
+static int mf_repdata_output_reserve (MF_OUTPUT_t *output, size_t size)
+{
+    AC_ALPHABET_t *astring;
+    size_t capacity;
+    
+    if (size <= output->capacity)
+        return 1;
+    
+    if (!output->growable)
+        return 0;
+    
+    capacity = output->capacity ? output->capacity : 64;
+    while (capacity < size)
+        capacity *= 2;
+    
+    astring = (AC_ALPHABET_t *) realloc (output->astring, 
+            capacity * sizeof(AC_ALPHABET_t));
+    if (!astring)
+        return 0;
+    
+    output->astring = astring;
+    output->capacity = capacity;
+    
+    return 1;
+}
+
+/**
+ * @brief Writes the segments of multifast_replace_tobuffer() to its output 
+ * buffer. Once the output does not fit, the rest is only counted. The 
+ * segments may overlap the buffer, as in multifast_replace_inplace().
+ * 
+ * @param segments
+ * @param count
+ * @param user the output buffer
+ *****************************************************************************/
+static void mf_repdata_output_listener 
+    (const AC_TEXT_t *segments, size_t count, void *user)
+{
+    MF_OUTPUT_t *output = (MF_OUTPUT_t *) user;
+    size_t i, end;
+    
+    for (i = 0; i < count; i++)
     {
-        mf_repdata_reset (&thiz->repdata);
-        thiz->last_node = thiz->root;
-        thiz->base_position = 0;
+        end = output->length + segments[i].length;
+        
+        if (segments[i].length && output->length <= output->capacity && 
+                mf_repdata_output_reserve (output, end))
+            memmove (&output->astring[output->length], segments[i].astring, 
+                    segments[i].length * sizeof(AC_ALPHABET_t));
+        
+        output->length = end;
     }
 }
@@ -60,6 +60,18 @@ struct mf_replacement_nominee
 };
 
 
+/**
+ * The output buffer of multifast_replace_tobuffer()
+ */
+typedef struct mf_output
+{
+    AC_ALPHABET_t *astring; /**< The buffer */
+    size_t length;          /**< Length of the output */
+    size_t capacity;        /**< Size of the buffer */
+    int growable;           /**< The buffer is malloc'd, or NULL, and it may 
+                             * be realloc'd to fit the output */
+} MF_OUTPUT_t;
+
 /**
  * Contains replacement related data
  */
@@ -67,19 +79,31 @@ typedef struct mf_replacement_date
 {
     AC_TEXT_t buffer;   /**< replacement buffer: maintains the result 
                          * of replacement */
+    size_t buffer_size; /**< Capacity of the replacement buffer */
+    
+    AC_TEXT_t *segments;    /**< The output of multifast_replacev(): the 
+                             * segments of the input text, the backlog and 
+                             * the replacement texts that make the result */
+    size_t segments_size;   /**< Number of the segments in the array */
     
     AC_TEXT_t backlog;  /**< replacement backlog: if a pattern is divided 
                          * between two or more different chunks, then at the 
                          * end of the first chunk we need to keep it here until 
                          * the next chunk comes and we decide if it is a 
                          * pattern or just a pattern prefix. */
+    size_t backlog_head;    /**< Start of the backlog in its buffer, which 
+                             * is circular */
     
     unsigned int has_replacement; /**< total number of to-be-replaced patterns 
                                    */
+    short expands;  /**< Some replacement is longer than its pattern, so the 
+                     * replacement may make the text longer */
     
-    struct mf_replacement_nominee *noms; /**< Replacement nominee array */
-    size_t noms_capacity; /**< Max capacity of the array */
-    size_t noms_size;  /**< Number of nominees in the array */
+    struct mf_replacement_nominee *noms; /**< Replacement nominee queue; a 
+                                          * circular buffer */
+    size_t noms_capacity; /**< Max capacity of the queue; a power of 2 */
+    size_t noms_head;  /**< Index of the first nominee in the array */
+    size_t noms_size;  /**< Number of nominees in the queue */
     
     size_t curser; /**< the position in the input text before which all 
                     * patterns are replaced and the result is saved to the
@@ -88,6 +112,9 @@ typedef struct mf_replacement_date
     MF_REPLACE_MODE_t replace_mode;  /**< Replace mode */
     
     MF_REPLACE_CALBACK_f cbf;   /**< Callback function */
+    MF_REPLACE_SEGMENTS_CALBACK_f scbf; /**< Callback function of the 
+                                         * segments; used instead of cbf 
+                                         * if not NULL */
     void *user;    /**< User parameters sent to the callback function */
     
     struct ac_trie *trie; /**< Pointer to the trie */
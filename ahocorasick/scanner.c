@@ -0,0 +1,265 @@
+/*
+ * scanner.c: Implements the interleaved scanning of independent streams
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+
+#include "node.h"
+#include "ahocorasick.h"
+#include "prefilter.h"
+#include "scanner.h"
+
+/* Privates */
+
+static int ac_scanner_interleave (AC_TRIE_t *thiz, AC_SCANNER_t *group,
+        size_t count, AC_MATCH_CALBACK_f callback);
+
+/* Friends */
+
+#ifdef AC_COUNTERS
+extern void ac_trie_count_hit
+    (AC_TRIE_t *thiz, ACT_NODE_t *node, AC_PATTERN_t *patt);
+extern unsigned long long ac_trie_clock (void);
+#endif
+
+
+/**
+ * @brief Initializes the scanner context of a stream
+ *
+ * @param thiz pointer to the scanner
+ * @param user this parameter will be send to the call-back function along
+ * with the matches of the stream
+ *****************************************************************************/
+void ac_scanner_init (AC_SCANNER_t *thiz, void *user)
+{
+    thiz->state = 0; /* The root node */
+    thiz->text.astring = NULL;
+    thiz->text.length = 0;
+    thiz->position = 0;
+    thiz->base_position = 0;
+    thiz->user = user;
+}
+
+/**
+ * @brief Feeds the next chunk of the stream to the scanner. The previous
+ * chunk must have been scanned to the end.
+ *
+ * @param thiz pointer to the scanner
+ * @param text the next chunk; the scanner keeps a reference to its string
+ *****************************************************************************/
+void ac_scanner_settext (AC_SCANNER_t *thiz, const AC_TEXT_t *text)
+{
+    thiz->base_position += thiz->position;
+    thiz->text = *text;
+    thiz->position = 0;
+}
+
+/**
+ * @brief Scans the current chunks of several independent streams.
+ *
+ * The streams are advanced in lockstep, AC_SCANNER_INTERLEAVE at a time:
+ * every round takes one step in each of the streams, so the memory loads of
+ * their transitions are issued close together and overlap instead of
+ * stalling one after the other. This is useful for automata much larger
+ * than the CPU cache. The streams may be different records or files, or
+ * segments of one buffer; in the latter case the matches that cross the
+ * segment boundaries are the caller's concern.
+ *
+ * The order in which the matches of different streams are reported is
+ * unspecified; the matches of each stream are reported in order.
+ * Patterns with boundary flags, or case sensitive patterns in the
+ * AC_CASE_PER_PATTERN mode, are not supported by this function.
+ *
+ * @param thiz pointer to the trie
+ * @param scanners the scanner contexts of the streams
+ * @param count number of the streams
+ * @param callback when a match occurs this function will be called with
+ * the user parameter of the stream. A non-0 return value stops the scan;
+ * calling the function again resumes it.
+ *
+ * The runtime counters of the trie are updated as by ac_trie_search().
+ *
+ * @return
+ * -2:  failed; the trie has patterns that need checks
+ * -1:  failed; trie is not finalized
+ *  0:  success; all the chunks were scanned to the end
+ *  1:  success; the chunks were scanned partially. (callback broke the loop)
+ *****************************************************************************/
+int ac_trie_scan (AC_TRIE_t *thiz, AC_SCANNER_t *scanners, size_t count,
+        AC_MATCH_CALBACK_f callback)
+{
+    size_t i, group;
+    int ret;
+
+    if (thiz->trie_open)
+        return -1;  /* Trie must be finalized first. */
+
+    if (thiz->patterns_checks)
+        return -2;
+
+    for (i = 0; i < count; i += group)
+    {
+        group = count - i;
+        if (group > AC_SCANNER_INTERLEAVE)
+            group = AC_SCANNER_INTERLEAVE;
+
+        if ((ret = ac_scanner_interleave (thiz, &scanners[i], group, callback)))
+            return ret;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Scans a group of streams in lockstep
+ *
+ * @param thiz pointer to the trie
+ * @param group the scanners of the group
+ * @param count number of the scanners; at most AC_SCANNER_INTERLEAVE
+ * @param callback
+ * @return 0 if the chunks are scanned to the end, 1 if the callback broke
+ * the loop
+ *****************************************************************************/
+static int ac_scanner_interleave (AC_TRIE_t *thiz, AC_SCANNER_t *group,
+        size_t count, AC_MATCH_CALBACK_f callback)
+{
+    AC_SCANNER_t *active[AC_SCANNER_INTERLEAVE];
+    ACT_NODE_t *current[AC_SCANNER_INTERLEAVE];
+    ACT_NODE_t *next;
+    ACT_NODE_t *root = thiz->root;
+    AC_SCANNER_t *sc;
+    AC_ALPHABET_t alpha;
+    AC_MATCH_t match;
+    const AC_ALPHABET_t *xlat = thiz->xlat;
+    AC_PREFILTER_t *prefilter = thiz->prefilter;
+    size_t i, n = 0;
+    int ret;
+#ifdef AC_COUNTERS
+    size_t j;
+#endif
+
+    for (i = 0; i < count; i++)
+    {
+        if (group[i].position < group[i].text.length)
+        {
+            active[n] = &group[i];
+            current[n] = thiz->nodes[group[i].state];
+            n++;
+        }
+    }
+
+    while (n)
+    {
+        /* Start loading the edges of all the streams before any of them
+         * is needed */
+        for (i = 0; i < n; i++)
+            AC_PREFETCH (current[i]->outgoing);
+
+        for (i = 0; i < n; )
+        {
+            sc = active[i];
+
+            if (prefilter && current[i] == root && !prefilter->start
+                    [(unsigned char) sc->text.astring[sc->position]])
+            {
+                /* Skip the bytes that keep us in the root node */
+                AC_COUNT (thiz->counters.skipped -= sc->position;
+                        thiz->counters.bytes -= sc->position);
+                sc->position = prefilter_skip (prefilter, sc->text.astring,
+                        sc->position, sc->text.length);
+                AC_COUNT (thiz->counters.skipped += sc->position;
+                        thiz->counters.bytes += sc->position);
+            }
+
+            if (sc->position < sc->text.length)
+            {
+                alpha = sc->text.astring[sc->position];
+                if (xlat)
+                    alpha = xlat[(unsigned char) alpha];
+
+                if (!(next = node_find_next_bs (current[i], alpha)))
+                {
+                    if (current[i]->failure_node)
+                    {
+                        current[i] = current[i]->failure_node;
+                        AC_COUNT (thiz->counters.failures++);
+                    }
+                    else
+                    {
+                        sc->position++;
+                        AC_COUNT (thiz->counters.bytes++);
+                    }
+                }
+                else
+                {
+                    current[i] = next;
+                    sc->position++;
+                    AC_COUNT (thiz->counters.gotos++;
+                            thiz->counters.bytes++);
+
+                    /* Start loading the next node for the next round */
+                    AC_PREFETCH (next);
+
+                    if (next->final)
+                    {
+                        match.position = sc->base_position + sc->position;
+                        match.size = next->matched_size;
+                        match.patterns = next->matched;
+
+                        AC_COUNT (
+                            for (j = 0; j < match.size; j++)
+                                ac_trie_count_hit (thiz, next,
+                                        &match.patterns[j]);
+                            thiz->counters.matches += match.size;
+                            thiz->counters.callbacks++;
+                            thiz->counters.callback_ns -= ac_trie_clock ());
+
+                        ret = callback (&match, sc->user);
+
+                        AC_COUNT (thiz->counters.callback_ns +=
+                                ac_trie_clock ());
+
+                        if (ret)
+                        {
+                            /* Save the status of all the active streams */
+                            for (i = 0; i < n; i++)
+                                active[i]->state = current[i]->id;
+                            return 1;
+                        }
+                    }
+                }
+            }
+
+            if (sc->position == sc->text.length)
+            {
+                /* The chunk is finished; drop the stream from the group */
+                sc->state = current[i]->id;
+                n--;
+                active[i] = active[n];
+                current[i] = current[n];
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * scanner.h: Defines the scanner context of an input stream
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SCANNER_H_
+#define _SCANNER_H_
+
+#include "actypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of the streams that are advanced in lockstep
+ */
+#define AC_SCANNER_INTERLEAVE 8
+
+/**
+ * The scanner context holds the search status of one input stream outside
+ * the trie, so a finalized trie can scan any number of independent streams.
+ * The current node of the automaton is kept by its id, which makes the
+ * context a small plain value.
+ */
+typedef struct ac_scanner
+{
+    unsigned int state;     /**< Id of the current node of the automaton */
+
+    AC_TEXT_t text;         /**< The current chunk of the stream */
+    size_t position;        /**< Position of the next byte in the chunk */
+    size_t base_position;   /**< Position of the chunk in the whole stream */
+
+    void *user;     /**< Passed to the call-back function along with the
+                     * matches of this stream */
+
+} AC_SCANNER_t;
+
+/*
+ * Scanner interface functions
+ */
+
+void ac_scanner_init (AC_SCANNER_t *thiz, void *user);
+void ac_scanner_settext (AC_SCANNER_t *thiz, const AC_TEXT_t *text);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
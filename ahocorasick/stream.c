@@ -0,0 +1,352 @@
+/*
+ * stream.c: Implements saving and loading the state of an input stream
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "node.h"
+#include "ahocorasick.h"
+#include "stream.h"
+
+/* Size of a saved nominee: its position, node id and pattern index */
+#define AC_STREAM_NOMINEE_SIZE \
+    (sizeof(unsigned long long) + 2 * sizeof(unsigned int))
+
+/* Privates */
+
+static void ac_stream_put (char **cursor, const void *value, size_t size);
+static int  ac_stream_get (const char **cursor, const char *end,
+        void *value, size_t size);
+static int  ac_stream_locate (AC_TRIE_t *thiz, AC_PATTERN_t *patt,
+        unsigned int *id, unsigned int *index);
+
+/* Friends */
+
+extern void ac_trie_reset (AC_TRIE_t *thiz);
+extern void mf_repdata_push_nominee 
+    (MF_REPLACEMENT_DATA_t *rd, struct mf_replacement_nominee *new_nom);
+
+
+/**
+ * @brief Returns the size of the current stream state
+ *
+ * It is the size of AC_STREAM_t for a plain search; the boundary checks and
+ * the replacement add the bytes that they carry over to the next chunk.
+ *
+ * @param thiz pointer to the trie
+ * @return the bytes that ac_trie_stream_save() needs
+ *****************************************************************************/
+size_t ac_trie_stream_size (AC_TRIE_t *thiz)
+{
+    MF_REPLACEMENT_DATA_t *rd = &thiz->repdata;
+    size_t size = sizeof(AC_STREAM_t);
+
+    if (thiz->history.astring)
+        size += sizeof(unsigned short) +
+                thiz->history.length * sizeof(AC_ALPHABET_t);
+
+    if (rd->has_replacement)
+        size += sizeof(unsigned long long) + sizeof(unsigned short) +
+                sizeof(unsigned int) +
+                rd->backlog.length * sizeof(AC_ALPHABET_t) +
+                rd->noms_size * AC_STREAM_NOMINEE_SIZE;
+
+    return size;
+}
+
+/**
+ * @brief Saves the state of the current input stream to the caller's memory
+ *
+ * Together with ac_trie_stream_load() it lets a single trie serve any number
+ * of concurrent streams, e.g. network flows: load the state of the stream,
+ * search or replace its next chunk, and save the state again. The state is
+ * the current node by its id and the position in the stream; see
+ * AC_STREAM_t for the rest. It is only valid for the same trie.
+ *
+ * The state must be saved between chunks: after ac_trie_search() or
+ * multifast_replace() returns, or after ac_trie_findnext() has returned
+ * the last match of the chunk. The replacement output which is waiting in
+ * the buffer is passed to the call-back function of the last
+ * multifast_replace() first, so the stream does not carry it.
+ *
+ * @param thiz pointer to the trie
+ * @param buffer receives the state
+ * @param size the size of the buffer; receives the size of the state,
+ * which is also set if the buffer is too small
+ * @return ACERR_SUCCESS, ACERR_TRIE_OPEN, or ACERR_STREAM_SPACE
+ *****************************************************************************/
+AC_STATUS_t ac_trie_stream_save (AC_TRIE_t *thiz, void *buffer, size_t *size)
+{
+    MF_REPLACEMENT_DATA_t *rd = &thiz->repdata;
+    struct mf_replacement_nominee *nom;
+    AC_STREAM_t stream;
+    char *cursor = (char *) buffer;
+    unsigned long long position;
+    unsigned short length;
+    unsigned int count, id, index;
+    size_t needed, first, i;
+
+    if (thiz->trie_open)
+        return ACERR_TRIE_OPEN;
+
+    needed = ac_trie_stream_size (thiz);
+
+    if (*size < needed)
+    {
+        *size = needed;
+        return ACERR_STREAM_SPACE;
+    }
+    *size = needed;
+
+    if (rd->buffer.length)
+        multifast_rep_flush (thiz, 1);
+
+    stream.state = (unsigned int) thiz->last_node->id;
+    stream.pending = thiz->pending_node ? (unsigned int) thiz->pending_node->id + 1 : 0;
+    stream.offset = thiz->base_position;
+    ac_stream_put (&cursor, &stream, sizeof(stream));
+
+    if (thiz->history.astring)
+    {
+        length = (unsigned short) thiz->history.length;
+        ac_stream_put (&cursor, &length, sizeof(length));
+        ac_stream_put (&cursor, thiz->history.astring,
+                thiz->history.length * sizeof(AC_ALPHABET_t));
+    }
+
+    if (rd->has_replacement)
+    {
+        position = rd->curser;
+        length = (unsigned short) rd->backlog.length;
+        count = (unsigned int) rd->noms_size;
+        ac_stream_put (&cursor, &position, sizeof(position));
+        ac_stream_put (&cursor, &length, sizeof(length));
+        ac_stream_put (&cursor, &count, sizeof(count));
+
+        /* The backlog and the nominees are circular buffers */
+        first = AC_PATTRN_MAX_LENGTH - rd->backlog_head;
+        if (first > rd->backlog.length)
+            first = rd->backlog.length;
+        ac_stream_put (&cursor, &rd->backlog.astring[rd->backlog_head],
+                first * sizeof(AC_ALPHABET_t));
+        ac_stream_put (&cursor, rd->backlog.astring,
+                (rd->backlog.length - first) * sizeof(AC_ALPHABET_t));
+
+        for (i = 0; i < rd->noms_size; i++)
+        {
+            nom = &rd->noms[(rd->noms_head + i) & (rd->noms_capacity - 1)];
+            if (!ac_stream_locate (thiz, nom->pattern, &id, &index))
+                return ACERR_STREAM_STATE; /* unexpected */
+
+            position = nom->position;
+            ac_stream_put (&cursor, &position, sizeof(position));
+            ac_stream_put (&cursor, &id, sizeof(id));
+            ac_stream_put (&cursor, &index, sizeof(index));
+        }
+    }
+
+    return ACERR_SUCCESS;
+}
+
+/**
+ * @brief Loads the state of an input stream that was saved by
+ * ac_trie_stream_save(), so that the trie continues that stream.
+ *
+ * The next chunk is fed with keep set to 1. A NULL buffer starts a new
+ * stream, the same as feeding a chunk with keep set to 0.
+ *
+ * @param thiz pointer to the trie
+ * @param buffer the saved state
+ * @param size the size of the saved state
+ * @return ACERR_SUCCESS, ACERR_TRIE_OPEN, or ACERR_STREAM_STATE; on error
+ * the trie is left with a new stream
+ *****************************************************************************/
+AC_STATUS_t ac_trie_stream_load (AC_TRIE_t *thiz, const void *buffer,
+        size_t size)
+{
+    MF_REPLACEMENT_DATA_t *rd = &thiz->repdata;
+    struct mf_replacement_nominee nom;
+    AC_STREAM_t stream;
+    ACT_NODE_t *node;
+    const char *cursor = (const char *) buffer;
+    const char *end = cursor + size;
+    unsigned long long position;
+    unsigned short length;
+    unsigned int count, id, index;
+    size_t i;
+
+    if (thiz->trie_open)
+        return ACERR_TRIE_OPEN;
+
+    ac_trie_reset (thiz);
+
+    if (!buffer)
+        return ACERR_SUCCESS;
+
+    if (!ac_stream_get (&cursor, end, &stream, sizeof(stream)) ||
+            stream.state >= thiz->nodes_count ||
+            stream.pending > thiz->nodes_count)
+        goto corrupt;
+
+    thiz->last_node = thiz->nodes[stream.state];
+    thiz->pending_node = stream.pending ?
+            thiz->nodes[stream.pending - 1] : NULL;
+    thiz->base_position = (size_t) stream.offset;
+
+    if (thiz->history.astring)
+    {
+        if (!ac_stream_get (&cursor, end, &length, sizeof(length)) ||
+                length > AC_PATTRN_MAX_LENGTH + 1 ||
+                !ac_stream_get (&cursor, end,
+                (AC_ALPHABET_t *) thiz->history.astring,
+                length * sizeof(AC_ALPHABET_t)))
+            goto corrupt;
+
+        thiz->history.length = length;
+    }
+
+    if (rd->has_replacement)
+    {
+        if (!ac_stream_get (&cursor, end, &position, sizeof(position)) ||
+                !ac_stream_get (&cursor, end, &length, sizeof(length)) ||
+                !ac_stream_get (&cursor, end, &count, sizeof(count)) ||
+                length > AC_PATTRN_MAX_LENGTH ||
+                position > stream.offset ||
+                !ac_stream_get (&cursor, end,
+                (AC_ALPHABET_t *) rd->backlog.astring,
+                length * sizeof(AC_ALPHABET_t)))
+            goto corrupt;
+
+        rd->curser = (size_t) position;
+        rd->backlog.length = length;
+
+        /* Do not trust the count to allocate before the nominees are read */
+        if (count > (size_t) (end - cursor) / AC_STREAM_NOMINEE_SIZE)
+            goto corrupt;
+
+        for (i = 0; i < count; i++)
+        {
+            if (!ac_stream_get (&cursor, end, &position, sizeof(position)) ||
+                    !ac_stream_get (&cursor, end, &id, sizeof(id)) ||
+                    !ac_stream_get (&cursor, end, &index, sizeof(index)) ||
+                    id >= thiz->nodes_count)
+                goto corrupt;
+
+            node = thiz->nodes[id];
+            if (index >= node->matched_size)
+                goto corrupt;
+
+            nom.pattern = &node->matched[index];
+            nom.position = (size_t) position;
+            mf_repdata_push_nominee (rd, &nom);
+        }
+    }
+
+    if (cursor != end)
+        goto corrupt;
+
+    return ACERR_SUCCESS;
+
+corrupt:
+    ac_trie_reset (thiz);
+    return ACERR_STREAM_STATE;
+}
+
+/**
+ * @brief Writes a value to the saved state
+ *
+ * @param cursor the write position; it is advanced
+ * @param value
+ * @param size
+ *****************************************************************************/
+static void ac_stream_put (char **cursor, const void *value, size_t size)
+{
+    if (size)
+        memcpy (*cursor, value, size);
+    *cursor += size;
+}
+
+/**
+ * @brief Reads a value from the saved state
+ *
+ * @param cursor the read position; it is advanced
+ * @param end the end of the saved state
+ * @param value receives the value
+ * @param size
+ * @return 1 on success, 0 if the state is too short
+ *****************************************************************************/
+static int ac_stream_get (const char **cursor, const char *end,
+        void *value, size_t size)
+{
+    if ((size_t) (end - *cursor) < size)
+        return 0;
+
+    if (size)
+        memcpy (value, *cursor, size);
+    *cursor += size;
+
+    return 1;
+}
+
+/**
+ * @brief Finds the node and the index of a pattern of the trie
+ *
+ * The nominees point to the patterns of the nodes, which are saved by the
+ * id of the node that owns the pattern, found by following the pattern
+ * string, and the index of the pattern in that node.
+ *
+ * @param thiz pointer to the trie
+ * @param patt the pattern
+ * @param id receives the id of the node
+ * @param index receives the index of the pattern in the node
+ * @return 1 on success, 0 if the pattern is not in the trie
+ *****************************************************************************/
+static int ac_stream_locate (AC_TRIE_t *thiz, AC_PATTERN_t *patt,
+        unsigned int *id, unsigned int *index)
+{
+    ACT_NODE_t *node = thiz->root;
+    AC_ALPHABET_t alpha;
+    size_t i;
+
+    for (i = 0; i < patt->ptext.length && node; i++)
+    {
+        alpha = patt->ptext.astring[i];
+        if (thiz->xlat)
+            alpha = thiz->xlat[(unsigned char) alpha];
+
+        node = node_find_next_bs (node, alpha);
+    }
+
+    if (!node)
+        return 0;
+
+    for (i = 0; i < node->matched_size; i++)
+    {
+        if (node->matched[i].ptext.astring == patt->ptext.astring &&
+                node->matched[i].ptext.length == patt->ptext.length &&
+                node->matched[i].flags == patt->flags)
+        {
+            *id = (unsigned int) node->id;
+            *index = (unsigned int) i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
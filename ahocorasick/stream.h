@@ -0,0 +1,60 @@
+/*
+ * stream.h: Defines the saved state of an input stream
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include "actypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The fixed part of a saved stream state. ac_trie_stream_save() writes it
+ * at the start of the caller's buffer, byte by byte, so the buffer needs no
+ * alignment. It is followed by:
+ *
+ * - if any pattern has boundary flags: the history, i.e. its length as an
+ *   unsigned short and the last bytes of the input
+ * - if any pattern has a replacement: the position of the replacement
+ *   cursor as an unsigned long long, the backlog length as an unsigned
+ *   short, the number of nominees as an unsigned int, the backlog bytes and
+ *   the nominees. A nominee is its end position as an unsigned long long,
+ *   and the id of the node of its pattern and the index of the pattern in
+ *   that node, as unsigned ints.
+ *
+ * The state of a plain search is just this structure.
+ */
+typedef struct ac_stream
+{
+    unsigned int state;     /**< Id of the node the stream stopped at */
+    unsigned int pending;   /**< Id of the node of the match that is held
+                             * back for its end boundary check, plus one;
+                             * 0 for none */
+    unsigned long long offset;  /**< Number of the input bytes so far */
+
+} AC_STREAM_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
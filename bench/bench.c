@@ -0,0 +1,346 @@
+/*
+ * bench.c: Reproducible benchmark of the search engines
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "ahocorasick.h"
+#include "generator.h"
+
+/* The pattern sets of the suite */
+static const struct gen_spec bench_specs[] = {
+    /* name          count  min  max  shared */
+    {"few-short",       10,   3,   8, 0.0},
+    {"small-mixed",    100,   4,  16, 0.0},
+    {"medium",        1000,   4,  24, 0.2},
+    {"large-shared", 10000,   6,  32, 0.5},
+    {"long",           200,  12,  40, 0.0},
+};
+
+static const AC_ENGINE_t bench_engines[] = {
+    AC_ENGINE_AUTOMATON,
+    AC_ENGINE_STARTBYTES,
+    AC_ENGINE_TEDDY,
+    AC_ENGINE_WUMANBER,
+    AC_ENGINE_AUTO
+};
+
+/* Options */
+static unsigned long long bench_seed = 1;
+static size_t bench_size = 8;   /* Corpus size in MB */
+static int bench_repeat = 3;    /* The best of the repeats is taken */
+static unsigned int bench_threads = 4;  /* Of multifast_replace_parallel() */
+
+/* The sink of the call-backs */
+static size_t bench_matches;
+static size_t bench_output;
+
+static const char *bench_engine_name (AC_ENGINE_t engine);
+static double bench_now (void);
+static int  bench_match_handler (AC_MATCH_t *m, void *param);
+static void bench_replace_listener (AC_TEXT_t *text, void *user);
+static void bench_segments_listener (const AC_TEXT_t *segments, size_t count,
+        void *user);
+static void bench_run (FILE *out, enum gen_corpus kind,
+        const struct gen_spec *spec, AC_ENGINE_t engine,
+        struct gen_patterns *patterns, const char *corpus, size_t size);
+
+/**
+ * @brief Prints the usage of the program
+ *
+ * @param progname
+ *****************************************************************************/
+static void bench_usage (const char *progname)
+{
+    printf ("Usage: %s [-o results.csv] [-s seed] [-n megabytes] "
+            "[-r repeat] [-t threads] [-q] [-h]\n", progname);
+}
+
+int main (int argc, char **argv)
+{
+    FILE *out = stdout;
+    int clopt;
+    size_t i, j, k, size;
+    struct gen_patterns patterns;
+    enum gen_corpus kind;
+    char *corpus;
+
+    while ((clopt = getopt (argc, argv, "o:s:n:r:t:qh")) != -1)
+    {
+        switch (clopt)
+        {
+            case 'o':
+                if (!(out = fopen (optarg, "w")))
+                {
+                    perror (optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                bench_seed = strtoull (optarg, NULL, 10);
+                break;
+            case 'n':
+                bench_size = strtoul (optarg, NULL, 10);
+                break;
+            case 'r':
+                bench_repeat = atoi (optarg);
+                break;
+            case 't':
+                bench_threads = (unsigned int) atoi (optarg);
+                break;
+            case 'q':
+                /* Quick run, e.g. for a smoke test */
+                bench_size = 1;
+                bench_repeat = 1;
+                break;
+            case 'h':
+            default:
+                bench_usage (argv[0]);
+                return clopt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (bench_size == 0 || bench_repeat < 1 || bench_threads < 1)
+    {
+        bench_usage (argv[0]);
+        return 1;
+    }
+
+    size = bench_size * 1024 * 1024;
+
+    fprintf (out, "corpus,patterns,count,min_length,max_length,shared,"
+            "engine,engine_used,corpus_bytes,added,add_ms,finalize_ms,"
+            "freeze_ms,memory_bytes,matches,search_mbps,replace_mbps,"
+            "replacev_mbps,parallel_mbps\n");
+
+    for (k = 0; k < GEN_CORPUS_COUNT; k++)
+    {
+        kind = (enum gen_corpus) k;
+
+        for (i = 0; i < sizeof(bench_specs) / sizeof(bench_specs[0]); i++)
+        {
+            /* Every combination has its own seed, so that a single one can
+             * be reproduced without running the others */
+            gen_seed (bench_seed * 1000 + k * 100 + i);
+
+            if (kind == GEN_CORPUS_DENSE)
+            {
+                gen_patterns (&patterns, &bench_specs[i], kind, NULL, 0);
+                corpus = gen_corpus (kind, size, &patterns);
+            }
+            else
+            {
+                corpus = gen_corpus (kind, size, NULL);
+                gen_patterns (&patterns, &bench_specs[i], kind, corpus, size);
+            }
+
+            fprintf (stderr, "%s / %s\n", gen_corpus_name (kind),
+                    bench_specs[i].name);
+
+            for (j = 0; j < sizeof(bench_engines) / sizeof(bench_engines[0]);
+                    j++)
+            {
+                bench_run (out, kind, &bench_specs[i], bench_engines[j],
+                        &patterns, corpus, size);
+            }
+
+            free (corpus);
+            gen_patterns_release (&patterns);
+        }
+    }
+
+    if (out != stdout)
+        fclose (out);
+
+    return 0;
+}
+
+/**
+ * @brief Builds a trie with the given engine and measures it
+ *
+ * @param out the results file
+ * @param kind the corpus kind
+ * @param spec the pattern set specification
+ * @param engine the requested engine
+ * @param patterns the pattern set
+ * @param corpus the input text
+ * @param size the size of the input text
+ *****************************************************************************/
+static void bench_run (FILE *out, enum gen_corpus kind,
+        const struct gen_spec *spec, AC_ENGINE_t engine,
+        struct gen_patterns *patterns, const char *corpus, size_t size)
+{
+    AC_TRIE_t *trie;
+    AC_TEXT_t text;
+    double t0, t1, t2, t3, best_search = 0, best_replace = 0;
+    double best_replacev = 0, best_parallel = 0, elapsed;
+    size_t i, matches = 0, memory;
+    int r;
+
+    t0 = bench_now ();
+
+    trie = ac_trie_create ();
+    ac_trie_setengine (trie, engine);
+
+    for (i = 0; i < patterns->count; i++)
+        ac_trie_add (trie, &patterns->patterns[i], 0);
+
+    t1 = bench_now ();
+    ac_trie_finalize (trie);
+    t2 = bench_now ();
+    ac_trie_freeze (trie);
+    t3 = bench_now ();
+
+    /* Before the replacement buffers grow with the input */
+    memory = ac_trie_memory (trie);
+
+    text.astring = corpus;
+    text.length = size;
+
+    for (r = 0; r < bench_repeat; r++)
+    {
+        bench_matches = 0;
+        elapsed = bench_now ();
+        ac_trie_search (trie, &text, 0, bench_match_handler, NULL);
+        ac_trie_search_flush (trie, bench_match_handler, NULL);
+        elapsed = bench_now () - elapsed;
+
+        if (r == 0 || elapsed < best_search)
+            best_search = elapsed;
+        matches = bench_matches;
+    }
+
+    for (r = 0; r < bench_repeat; r++)
+    {
+        bench_output = 0;
+        elapsed = bench_now ();
+        multifast_replace (trie, &text, MF_REPLACE_MODE_NORMAL,
+                bench_replace_listener, NULL);
+        multifast_rep_flush (trie, 0);
+        elapsed = bench_now () - elapsed;
+
+        if (r == 0 || elapsed < best_replace)
+            best_replace = elapsed;
+    }
+
+    for (r = 0; r < bench_repeat; r++)
+    {
+        bench_output = 0;
+        elapsed = bench_now ();
+        multifast_replacev (trie, &text, MF_REPLACE_MODE_NORMAL,
+                bench_segments_listener, NULL);
+        multifast_rep_flush (trie, 0);
+        elapsed = bench_now () - elapsed;
+
+        if (r == 0 || elapsed < best_replacev)
+            best_replacev = elapsed;
+    }
+
+    for (r = 0; r < bench_repeat; r++)
+    {
+        bench_output = 0;
+        elapsed = bench_now ();
+        multifast_replace_parallel (trie, &text, MF_REPLACE_MODE_NORMAL,
+                bench_threads, bench_segments_listener, NULL);
+        elapsed = bench_now () - elapsed;
+
+        if (r == 0 || elapsed < best_parallel)
+            best_parallel = elapsed;
+    }
+
+    fprintf (out, "%s,%s,%lu,%lu,%lu,%.2f,%s,%s,%lu,%lu,%.3f,%.3f,%.3f,"
+            "%lu,%lu,%.1f,%.1f,%.1f,%.1f\n",
+            gen_corpus_name (kind), spec->name,
+            (unsigned long) spec->count, (unsigned long) spec->min_length,
+            (unsigned long) spec->max_length, spec->shared,
+            bench_engine_name (engine), bench_engine_name (trie->engine),
+            (unsigned long) size, (unsigned long) trie->patterns_count,
+            (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t3 - t2) * 1e3,
+            (unsigned long) memory, (unsigned long) matches,
+            size / best_search / 1e6, size / best_replace / 1e6,
+            size / best_replacev / 1e6, size / best_parallel / 1e6);
+    fflush (out);
+
+    ac_trie_release (trie);
+}
+
+/**
+ * @brief Returns the name of the engine
+ *
+ * @param engine
+ * @return
+ *****************************************************************************/
+static const char *bench_engine_name (AC_ENGINE_t engine)
+{
+    switch (engine)
+    {
+        case AC_ENGINE_AUTO:        return "auto";
+        case AC_ENGINE_AUTOMATON:   return "automaton";
+        case AC_ENGINE_STARTBYTES:  return "startbytes";
+        case AC_ENGINE_TEDDY:       return "teddy";
+        case AC_ENGINE_WUMANBER:    return "wumanber";
+        default:                    return "unknown";
+    }
+}
+
+/**
+ * @brief Reads the monotonic clock
+ *
+ * @return the time in seconds
+ *****************************************************************************/
+static double bench_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Counts the matches
+ *****************************************************************************/
+static int bench_match_handler (AC_MATCH_t *m, void *param)
+{
+    bench_matches += m->size;
+    return 0;
+}
+
+/**
+ * @brief Counts the output of the replacement
+ *****************************************************************************/
+static void bench_replace_listener (AC_TEXT_t *text, void *user)
+{
+    bench_output += text->length;
+}
+
+/**
+ * @brief Counts the output of the replacement, segment by segment
+ *****************************************************************************/
+static void bench_segments_listener (const AC_TEXT_t *segments, size_t count,
+        void *user)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        bench_output += segments[i].length;
+}
@@ -0,0 +1,385 @@
+/*
+ * generator.c: Synthetic corpus and pattern set generators
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "generator.h"
+
+/* Number of the words of the natural language dictionary */
+#define GEN_WORDS 4096
+
+/* Maximum length of a dictionary word */
+#define GEN_WORD_LENGTH 16
+
+/* Number of the common prefixes of the pattern sets */
+#define GEN_PREFIXES 8
+
+/* Size of the text sample from which the patterns are taken */
+#define GEN_SAMPLE_SIZE (256*1024)
+
+/* The generator is independent of the C library, so that the same seed
+ * gives the same corpus everywhere */
+static unsigned long long gen_state = 1;
+
+static char gen_words[GEN_WORDS][GEN_WORD_LENGTH + 1];
+static double gen_zipf[GEN_WORDS]; /* Cumulative word frequencies */
+static int gen_dictionary_ready = 0;
+
+static const char *gen_syllables[] = {
+    "a", "e", "i", "o", "u", "an", "en", "in", "on", "er", "re", "ti", "te",
+    "ka", "ma", "na", "ra", "sa", "ta", "la", "de", "le", "se", "ro", "ne",
+    "st", "th", "ch", "ing", "ion", "ent", "and", "the", "for", "al", "is"
+};
+
+static void gen_dictionary (void);
+static size_t gen_word (void);
+static void gen_fill (enum gen_corpus kind, char *text, size_t size);
+static void gen_natural (char *text, size_t size);
+
+/**
+ * @brief Seeds the generator
+ *
+ * @param seed
+ *****************************************************************************/
+void gen_seed (unsigned long long seed)
+{
+    gen_state = seed;
+}
+
+/**
+ * @brief Generates the next random number (splitmix64)
+ *
+ * @return
+ *****************************************************************************/
+unsigned long long gen_random (void)
+{
+    unsigned long long z = (gen_state += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Generates a random number in the given range
+ *
+ * @param min
+ * @param max
+ * @return a number between min and max, inclusive
+ *****************************************************************************/
+size_t gen_range (size_t min, size_t max)
+{
+    return min + (size_t) (gen_random () % (max - min + 1));
+}
+
+/**
+ * @brief Returns the name of the corpus kind
+ *
+ * @param kind
+ * @return
+ *****************************************************************************/
+const char *gen_corpus_name (enum gen_corpus kind)
+{
+    switch (kind)
+    {
+        case GEN_CORPUS_RANDOM:  return "random";
+        case GEN_CORPUS_NATURAL: return "natural";
+        case GEN_CORPUS_BINARY:  return "binary";
+        case GEN_CORPUS_DENSE:   return "dense";
+        default:                 return "unknown";
+    }
+}
+
+/**
+ * @brief Generates a pattern set
+ *
+ * The patterns are taken from the text that they are searched in: half of
+ * them are substrings of the text, so they do occur in it, and the other
+ * half are random strings of the same alphabet. The dense corpus is made of
+ * the patterns, so it is generated after them, and its patterns are random
+ * lower case strings. Duplicates are possible; the trie rejects them.
+ *
+ * @param thiz receives the pattern set
+ * @param spec the specification of the set
+ * @param kind the corpus the patterns are meant for
+ * @param text the corpus; NULL for the dense corpus
+ * @param size the size of the corpus; at least GEN_SAMPLE_SIZE
+ *****************************************************************************/
+void gen_patterns (struct gen_patterns *thiz, const struct gen_spec *spec,
+        enum gen_corpus kind, const char *text, size_t size)
+{
+    char prefixes[GEN_PREFIXES][8];
+    char *sample = NULL, *p;
+    size_t i, j, length, rlength, prefix;
+    enum gen_corpus alphabet;
+
+    alphabet = (kind == GEN_CORPUS_DENSE) ? GEN_CORPUS_RANDOM : kind;
+
+    if (!text || size < GEN_SAMPLE_SIZE)
+    {
+        sample = (char *) malloc (GEN_SAMPLE_SIZE);
+        gen_fill (alphabet, sample, GEN_SAMPLE_SIZE);
+        text = sample;
+        size = GEN_SAMPLE_SIZE;
+    }
+
+    for (i = 0; i < GEN_PREFIXES; i++)
+    {
+        memcpy (prefixes[i], text + gen_range (0, size - 8), 8);
+    }
+
+    thiz->count = spec->count;
+    thiz->patterns = (AC_PATTERN_t *)
+            calloc (spec->count, sizeof(AC_PATTERN_t));
+    thiz->storage = (char *)
+            malloc (spec->count * (2 * spec->max_length + 2));
+
+    p = thiz->storage;
+
+    for (i = 0; i < spec->count; i++)
+    {
+        length = gen_range (spec->min_length, spec->max_length);
+
+        if (i % 2)
+            memcpy (p, text + gen_range (0, size - length), length);
+        else
+            gen_fill (alphabet, p, length);
+
+        if (gen_random () % 1000 < spec->shared * 1000)
+        {
+            prefix = (length > 8) ? 6 : length - 1;
+            memcpy (p, prefixes[gen_random () % GEN_PREFIXES], prefix);
+        }
+
+        if (kind == GEN_CORPUS_DENSE)
+            for (j = 0; j < length; j++)
+                p[j] = 'a' + (unsigned char) p[j] % 26;
+
+        thiz->patterns[i].ptext.astring = p;
+        thiz->patterns[i].ptext.length = length;
+        thiz->patterns[i].id.u.number = i;
+        thiz->patterns[i].id.type = AC_PATTID_TYPE_NUMBER;
+        p += length;
+
+        /* Shrinking, equal and growing replacements */
+        rlength = gen_range (0, length + 1);
+        for (j = 0; j < rlength; j++)
+            p[j] = 'A' + j % 26;
+
+        thiz->patterns[i].rtext.astring = p;
+        thiz->patterns[i].rtext.length = rlength;
+        p += rlength;
+    }
+
+    free (sample);
+}
+
+/**
+ * @brief Releases a pattern set
+ *
+ * @param thiz
+ *****************************************************************************/
+void gen_patterns_release (struct gen_patterns *thiz)
+{
+    free (thiz->patterns);
+    free (thiz->storage);
+}
+
+/**
+ * @brief Generates a corpus
+ *
+ * @param kind the kind of the text
+ * @param size the size of the text in bytes
+ * @param patterns the pattern set; only used by the dense corpus
+ * @return the text; the caller must free it
+ *****************************************************************************/
+char *gen_corpus (enum gen_corpus kind, size_t size,
+        const struct gen_patterns *patterns)
+{
+    char *text = (char *) malloc (size);
+    const AC_PATTERN_t *patt;
+    size_t position = 0, length;
+
+    if (kind != GEN_CORPUS_DENSE)
+    {
+        gen_fill (kind, text, size);
+        return text;
+    }
+
+    /* Patterns with up to 3 random bytes in between */
+    while (position < size)
+    {
+        patt = &patterns->patterns[gen_random () % patterns->count];
+
+        length = patt->ptext.length;
+        if (length > size - position)
+            length = size - position;
+
+        memcpy (text + position, patt->ptext.astring, length);
+        position += length;
+
+        length = gen_range (0, 3);
+        if (length > size - position)
+            length = size - position;
+
+        gen_fill (GEN_CORPUS_RANDOM, text + position, length);
+        position += length;
+    }
+
+    return text;
+}
+
+/**
+ * @brief Fills the text with the alphabet of the corpus kind
+ *
+ * @param kind
+ * @param text
+ * @param size
+ *****************************************************************************/
+static void gen_fill (enum gen_corpus kind, char *text, size_t size)
+{
+    size_t i;
+
+    switch (kind)
+    {
+        case GEN_CORPUS_NATURAL:
+            gen_natural (text, size);
+            break;
+
+        case GEN_CORPUS_BINARY:
+            for (i = 0; i < size; i++)
+                text[i] = (char) (gen_random () & 0xFF);
+            break;
+
+        default:
+            for (i = 0; i < size; i++)
+                text[i] = (char) (' ' + gen_random () % 95);
+            break;
+    }
+}
+
+/**
+ * @brief Generates natural language like text: Zipf distributed words in
+ * sentences, broken into lines
+ *
+ * @param text
+ * @param size
+ *****************************************************************************/
+static void gen_natural (char *text, size_t size)
+{
+    size_t position = 0, line = 0, length, i;
+    int sentence_start = 1;
+    const char *word;
+
+    gen_dictionary ();
+
+    while (position < size)
+    {
+        word = gen_words[gen_word ()];
+        length = strlen (word);
+
+        for (i = 0; i < length && position < size; i++)
+        {
+            text[position++] = (sentence_start && i == 0) ?
+                    word[i] - 'a' + 'A' : word[i];
+        }
+
+        line += length + 1;
+        sentence_start = (gen_random () % 12 == 0);
+
+        if (sentence_start && position < size)
+            text[position++] = (gen_random () % 4) ? '.' : ',';
+
+        if (position < size)
+        {
+            if (line > 72)
+            {
+                text[position++] = '\n';
+                line = 0;
+            }
+            else
+            {
+                text[position++] = ' ';
+            }
+        }
+    }
+}
+
+/**
+ * @brief Builds the dictionary of the natural language text
+ *****************************************************************************/
+static void gen_dictionary (void)
+{
+    const size_t syllables = sizeof(gen_syllables) / sizeof(gen_syllables[0]);
+    unsigned long long state = gen_state;
+    size_t i, n;
+    double total = 0;
+
+    if (gen_dictionary_ready)
+        return;
+
+    /* The dictionary is the same whatever the seed */
+    gen_seed (0x5EED);
+
+    for (i = 0; i < GEN_WORDS; i++)
+    {
+        gen_words[i][0] = '\0';
+
+        /* The frequent words are the short ones */
+        for (n = (i < 64) ? 1 : gen_range (2, 4); n > 0; n--)
+        {
+            if (strlen (gen_words[i]) + 3 <= GEN_WORD_LENGTH)
+                strcat (gen_words[i],
+                        gen_syllables[gen_random () % syllables]);
+        }
+
+        total += 1.0 / (i + 1);
+        gen_zipf[i] = total;
+    }
+
+    for (i = 0; i < GEN_WORDS; i++)
+        gen_zipf[i] /= total;
+
+    gen_state = state;
+    gen_dictionary_ready = 1;
+}
+
+/**
+ * @brief Picks a word of the dictionary by its Zipf frequency
+ *
+ * @return the index of the word
+ *****************************************************************************/
+static size_t gen_word (void)
+{
+    double r = (gen_random () >> 11) * (1.0 / 9007199254740992.0);
+    size_t low = 0, high = GEN_WORDS - 1, mid;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+        if (gen_zipf[mid] < r)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
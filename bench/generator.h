@@ -0,0 +1,75 @@
+/*
+ * generator.h: Synthetic corpus and pattern set generators
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _GENERATOR_H_
+#define _GENERATOR_H_
+
+#include "ahocorasick.h"
+
+/**
+ * Kinds of the synthetic input text
+ */
+enum gen_corpus
+{
+    GEN_CORPUS_RANDOM = 0,  /**< Uniformly random printable ASCII */
+    GEN_CORPUS_NATURAL,     /**< Words with a Zipf distribution, sentences
+                             * and lines, like natural language text */
+    GEN_CORPUS_BINARY,      /**< Uniformly random bytes */
+    GEN_CORPUS_DENSE,       /**< The patterns themselves, a few bytes apart */
+    GEN_CORPUS_COUNT
+};
+
+/**
+ * Specification of a pattern set
+ */
+struct gen_spec
+{
+    const char *name;   /**< Name of the set in the results */
+    size_t count;       /**< Number of the patterns */
+    size_t min_length;  /**< Length of the patterns is uniformly distributed */
+    size_t max_length;  /**< between min_length and max_length */
+    double shared;      /**< Fraction of the patterns which start with one of
+                         * a few common prefixes */
+};
+
+/**
+ * A generated pattern set
+ */
+struct gen_patterns
+{
+    AC_PATTERN_t *patterns; /**< The patterns; they all have a replacement */
+    size_t count;           /**< Number of the patterns */
+    char *storage;          /**< Holds the pattern and replacement strings */
+};
+
+void gen_seed (unsigned long long seed);
+unsigned long long gen_random (void);
+size_t gen_range (size_t min, size_t max);
+
+const char *gen_corpus_name (enum gen_corpus kind);
+
+void gen_patterns (struct gen_patterns *thiz, const struct gen_spec *spec,
+        enum gen_corpus kind, const char *text, size_t size);
+void gen_patterns_release (struct gen_patterns *thiz);
+
+char *gen_corpus (enum gen_corpus kind, size_t size,
+        const struct gen_patterns *patterns);
+
+#endif /* _GENERATOR_H_ */
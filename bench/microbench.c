@@ -0,0 +1,475 @@
+/*
+ * microbench.c: Microbenchmark of the transition lookup strategies
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Builds nodes with a controlled fan-out, then measures the time of a
+ * transition lookup with each strategy:
+ *
+ *   linear   node_find_next(): linear scan of the edges
+ *   binary   binary search of the sorted edges
+ *   table    a 256 entry table of the children, indexed by the byte
+ *   library  node_find_next_bs(), which picks between linear and binary by
+ *            the fan-out of the node (see NODE_LINEAR_SEARCH_MAX)
+ *
+ * The edges and the looked up bytes are drawn either uniformly from all the
+ * 256 bytes, or from the lower case letters with English letter frequencies.
+ * Where perf_event_open() is available, the CPU cycles, instructions and
+ * branch misses per lookup are reported as well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "ahocorasick.h"
+#include "node.h"
+#include "generator.h"
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define MICRO_PERF
+#endif
+
+/* Number of nodes; enough to fall out of the first level caches */
+#define MICRO_NODES 4096
+
+/* Number of lookups per measurement */
+#define MICRO_LOOKUPS (1 << 20)
+
+/* Number of the hardware counters */
+#define MICRO_COUNTERS 3
+
+/* Number of measurements of each strategy; the median time is reported */
+#define MICRO_REPEATS 7
+
+enum micro_strategy
+{
+    MICRO_LINEAR = 0,
+    MICRO_BINARY,
+    MICRO_TABLE,
+    MICRO_LIBRARY,
+    MICRO_STRATEGIES
+};
+
+static const char *micro_strategy_names[MICRO_STRATEGIES] = {
+    "linear", "binary", "table", "library"
+};
+
+enum micro_alphabet
+{
+    MICRO_UNIFORM = 0,  /* All the bytes */
+    MICRO_TEXT,         /* Lower case letters, English frequencies */
+    MICRO_ALPHABETS
+};
+
+static const char *micro_alphabet_names[MICRO_ALPHABETS] = {
+    "uniform", "text"
+};
+
+/* Frequencies of the English letters per 1000 */
+static const int micro_letters[26] = {
+    82, 15, 28, 43, 127, 22, 20, 61, 70, 2, 8, 40, 24,
+    67, 75, 19, 1, 60, 63, 91, 28, 10, 24, 2, 20, 1
+};
+
+static const size_t micro_fanouts[] = {
+    1, 2, 3, 4, 5, 6, 8, 10, 12, 16, 20, 26, 32, 48, 64, 128, 256
+};
+
+static int micro_perf_fd[MICRO_COUNTERS] = {-1, -1, -1};
+
+static ACT_NODE_t *micro_nodes[MICRO_NODES];
+static ACT_NODE_t **micro_tables;   /* MICRO_NODES x 256 children */
+static unsigned short micro_query_node[MICRO_LOOKUPS];
+static AC_ALPHABET_t micro_query_alpha[MICRO_LOOKUPS];
+
+static AC_ALPHABET_t micro_byte (enum micro_alphabet alphabet);
+static void   micro_build (AC_TRIE_t *trie, enum micro_alphabet alphabet,
+        size_t fanout);
+static double micro_measure (enum micro_strategy strategy,
+        long long counters[MICRO_COUNTERS]);
+static double micro_median (double *samples, size_t count);
+static int    micro_compare (const void *a, const void *b);
+static void   micro_perf_open (void);
+static double micro_now (void);
+
+int main (int argc, char **argv)
+{
+    FILE *out = stdout;
+    AC_TRIE_t *trie;
+    long long counters[MICRO_COUNTERS];
+    long long sums[MICRO_STRATEGIES][MICRO_COUNTERS];
+    double samples[MICRO_STRATEGIES][MICRO_REPEATS];
+    double ns[MICRO_STRATEGIES];
+    size_t i, k, r, threshold[MICRO_ALPHABETS];
+    int a, s, clopt;
+
+    while ((clopt = getopt (argc, argv, "o:h")) != -1)
+    {
+        switch (clopt)
+        {
+            case 'o':
+                if (!(out = fopen (optarg, "w")))
+                {
+                    perror (optarg);
+                    return 1;
+                }
+                break;
+            default:
+                printf ("Usage: %s [-o results.csv] [-h]\n", argv[0]);
+                return clopt == 'h' ? 0 : 1;
+        }
+    }
+
+    micro_perf_open ();
+    micro_tables = (ACT_NODE_t **)
+            malloc (MICRO_NODES * 256 * sizeof(ACT_NODE_t *));
+
+    fprintf (out, "alphabet,fanout,strategy,ns_per_lookup,"
+            "cycles_per_lookup,instructions_per_lookup,"
+            "branch_misses_per_lookup\n");
+
+    for (a = 0; a < MICRO_ALPHABETS; a++)
+    {
+        threshold[a] = 0;
+
+        for (k = 0; k < sizeof(micro_fanouts) / sizeof(micro_fanouts[0]); k++)
+        {
+            if (a == MICRO_TEXT && micro_fanouts[k] > 26)
+                break;
+
+            gen_seed (k + 1);
+
+            /* A trie only serves as the owner of the nodes */
+            trie = ac_trie_create ();
+            micro_build (trie, (enum micro_alphabet) a, micro_fanouts[k]);
+
+            memset (sums, 0, sizeof(sums));
+
+            /* The strategies take turns, so that a slow spell of the
+             * machine does not fall on one of them only */
+            for (r = 0; r < MICRO_REPEATS; r++)
+            {
+                for (s = 0; s < MICRO_STRATEGIES; s++)
+                {
+                    samples[s][r] = micro_measure ((enum micro_strategy) s,
+                            counters);
+
+                    for (i = 0; i < MICRO_COUNTERS; i++)
+                        sums[s][i] = (counters[i] < 0 || sums[s][i] < 0) ?
+                                -1 : sums[s][i] + counters[i];
+                }
+            }
+
+            for (s = 0; s < MICRO_STRATEGIES; s++)
+            {
+                ns[s] = micro_median (samples[s], MICRO_REPEATS);
+
+                fprintf (out, "%s,%lu,%s,%.2f", micro_alphabet_names[a],
+                        (unsigned long) micro_fanouts[k],
+                        micro_strategy_names[s], ns[s]);
+
+                for (i = 0; i < MICRO_COUNTERS; i++)
+                {
+                    if (sums[s][i] < 0)
+                        fprintf (out, ",NA");
+                    else
+                        fprintf (out, ",%.2f", (double) sums[s][i] /
+                                MICRO_REPEATS / MICRO_LOOKUPS);
+                }
+                fprintf (out, "\n");
+            }
+
+            /* The largest fan-out at which the linear scan still wins; a
+             * noisy sample at a small fan-out does not cut it short */
+            if (ns[MICRO_LINEAR] <= ns[MICRO_BINARY])
+                threshold[a] = micro_fanouts[k];
+
+            for (i = 0; i < MICRO_NODES; i++)
+                node_release_vectors (micro_nodes[i]);
+            ac_trie_release (trie);
+        }
+    }
+
+    fprintf (stderr, "Largest fan-out where the linear scan is faster: "
+            "%lu (uniform), %lu (text); NODE_LINEAR_SEARCH_MAX is %d\n",
+            (unsigned long) threshold[MICRO_UNIFORM],
+            (unsigned long) threshold[MICRO_TEXT], NODE_LINEAR_SEARCH_MAX);
+
+    if (out != stdout)
+        fclose (out);
+    free (micro_tables);
+
+    return 0;
+}
+
+/**
+ * @brief Draws a byte of the alphabet
+ *
+ * @param alphabet
+ * @return
+ *****************************************************************************/
+static AC_ALPHABET_t micro_byte (enum micro_alphabet alphabet)
+{
+    int r, i;
+
+    if (alphabet == MICRO_UNIFORM)
+        return (AC_ALPHABET_t) (gen_random () & 0xFF);
+
+    r = gen_random () % 1000;
+
+    for (i = 0; i < 25 && r >= micro_letters[i]; i++)
+        r -= micro_letters[i];
+
+    return (AC_ALPHABET_t) ('a' + i);
+}
+
+/**
+ * @brief Builds the nodes and the lookups
+ *
+ * Every node gets fanout distinct edges to random nodes. Half of the
+ * lookups are for the bytes of the edges, which succeed, and half are
+ * drawn from the alphabet, which may fail as they do in the search loop.
+ *
+ * @param trie
+ * @param alphabet
+ * @param fanout
+ *****************************************************************************/
+static void micro_build (AC_TRIE_t *trie, enum micro_alphabet alphabet,
+        size_t fanout)
+{
+    size_t i, j;
+    AC_ALPHABET_t alpha;
+    ACT_NODE_t *node;
+
+    for (i = 0; i < MICRO_NODES; i++)
+        micro_nodes[i] = node_create (trie);
+
+    memset (micro_tables, 0, MICRO_NODES * 256 * sizeof(ACT_NODE_t *));
+
+    for (i = 0; i < MICRO_NODES; i++)
+    {
+        node = micro_nodes[i];
+
+        for (j = 0; j < fanout; j++)
+        {
+            /* The letters are drawn uniformly, so that the fan-out can be
+             * reached */
+            do
+                alpha = (alphabet == MICRO_UNIFORM) ?
+                        micro_byte (alphabet) :
+                        (AC_ALPHABET_t) ('a' + gen_random () % 26);
+            while (node_find_next (node, alpha));
+
+            node_add_edge (node,
+                    micro_nodes[gen_random () % MICRO_NODES], alpha);
+            micro_tables[i * 256 + (unsigned char) alpha] =
+                    node->outgoing[node->outgoing_size - 1].next;
+        }
+
+        node_sort_edges (node);
+    }
+
+    for (i = 0; i < MICRO_LOOKUPS; i++)
+    {
+        micro_query_node[i] = gen_random () % MICRO_NODES;
+        node = micro_nodes[micro_query_node[i]];
+
+        if (i % 2)
+            micro_query_alpha[i] =
+                    node->outgoing[gen_random () % fanout].alpha;
+        else
+            micro_query_alpha[i] = micro_byte (alphabet);
+    }
+}
+
+/**
+ * @brief Measures a strategy
+ *
+ * @param strategy
+ * @param counters receives the hardware counters; -1 if not available
+ * @return the time per lookup in nanoseconds
+ *****************************************************************************/
+static double micro_measure (enum micro_strategy strategy,
+        long long counters[MICRO_COUNTERS])
+{
+    size_t i, found = 0;
+    double elapsed;
+    ACT_NODE_t *node, *next;
+    AC_ALPHABET_t alpha, amid;
+    int min, max, mid;
+
+    for (i = 0; i < MICRO_COUNTERS; i++)
+    {
+        counters[i] = -1;
+#ifdef MICRO_PERF
+        if (micro_perf_fd[i] >= 0)
+        {
+            ioctl (micro_perf_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl (micro_perf_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    elapsed = micro_now ();
+
+    for (i = 0; i < MICRO_LOOKUPS; i++)
+    {
+        node = micro_nodes[micro_query_node[i]];
+        alpha = micro_query_alpha[i];
+        next = NULL;
+
+        switch (strategy)
+        {
+            case MICRO_LINEAR:
+                next = node_find_next (node, alpha);
+                break;
+
+            case MICRO_BINARY:
+                min = 0;
+                max = node->outgoing_size - 1;
+                while (min <= max)
+                {
+                    mid = (min + max) >> 1;
+                    amid = node->outgoing[mid].alpha;
+                    if (alpha > amid)
+                        min = mid + 1;
+                    else if (alpha < amid)
+                        max = mid - 1;
+                    else
+                    {
+                        next = node->outgoing[mid].next;
+                        break;
+                    }
+                }
+                break;
+
+            case MICRO_TABLE:
+                next = micro_tables[micro_query_node[i] * 256 +
+                        (unsigned char) alpha];
+                break;
+
+            default:
+                next = node_find_next_bs (node, alpha);
+                break;
+        }
+
+        found += (next != NULL);
+    }
+
+    elapsed = micro_now () - elapsed;
+
+#ifdef MICRO_PERF
+    for (i = 0; i < MICRO_COUNTERS; i++)
+    {
+        if (micro_perf_fd[i] >= 0)
+        {
+            ioctl (micro_perf_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read (micro_perf_fd[i], &counters[i], sizeof(long long)) !=
+                    sizeof(long long))
+                counters[i] = -1;
+        }
+    }
+#endif
+
+    /* Keeps the compiler from dropping the lookups */
+    if (found > MICRO_LOOKUPS)
+        fprintf (stderr, "unexpected\n");
+
+    return elapsed * 1e9 / MICRO_LOOKUPS;
+}
+
+/**
+ * @brief Finds the median of the samples, which are sorted in place
+ *
+ * @param samples
+ * @param count
+ * @return the median
+ *****************************************************************************/
+static double micro_median (double *samples, size_t count)
+{
+    qsort (samples, count, sizeof(double), micro_compare);
+
+    return (count % 2) ? samples[count / 2] :
+            (samples[count / 2 - 1] + samples[count / 2]) / 2;
+}
+
+/**
+ * @brief Compares two samples for qsort()
+ *
+ * @param a
+ * @param b
+ * @return
+ *****************************************************************************/
+static int micro_compare (const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Opens the hardware counters, if the system allows it
+ *****************************************************************************/
+static void micro_perf_open (void)
+{
+#ifdef MICRO_PERF
+    static const unsigned long long configs[MICRO_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < MICRO_COUNTERS; i++)
+    {
+        memset (&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        micro_perf_fd[i] = syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    if (micro_perf_fd[0] < 0)
+        fprintf (stderr, "Hardware counters are not available\n");
+#endif
+}
+
+/**
+ * @brief Reads the monotonic clock
+ *
+ * @return the time in seconds
+ *****************************************************************************/
+static double micro_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -52,8 +52,8 @@ void listener (AC_TEXT_t *text, void *user);
  *      1. the replacement buffer is full
  *      2. the _rep_flush() is called
  * 
- * Replacement buffer size is determined by the MF_REPLACEMENT_BUFFER_SIZE 
- * macro
+ * Replacement buffer size is MF_REPLACEMENT_BUFFER_SIZE by default; it can 
+ * be set with ac_trie_setbuffer() before the trie is finalized
  */
 
 int main (int argc, char **argv)
@@ -67,6 +67,9 @@ AhoCorasickPlus::EnumReturnStatus AhoCorasickPlus::addPattern
         case ACERR_TRIE_CLOSED: 
             rv = RETURNSTATUS_AUTOMATA_CLOSED; 
             break;
+        default:
+            rv = RETURNSTATUS_FAILED;
+            break;
     }
     return rv;
 }
@@ -92,31 +95,13 @@ void AhoCorasickPlus::search (std::string& text, bool keep)
 
 bool AhoCorasickPlus::findNext (Match& match)
 {
-    if (m_matchQueue.size() > 0)
-    {
-        match = m_matchQueue.front();
-        m_matchQueue.pop();
-        return true;
-    }
-    
     AC_MATCH_t matchp;
     
-    if ((matchp = ac_trie_findnext (m_automata)).size)
-    {
-        Match singleMatch;
-        singleMatch.position = matchp.position;
-        
-        for (unsigned int j = 0; j < matchp.size; j++)
-        {
-            singleMatch.id = matchp.patterns[j].id.u.number;
-            m_matchQueue.push(singleMatch);
-        }
-    }
-    
-    if (m_matchQueue.size() > 0)
+    // The patterns which end at the same position are returned one by one
+    if ((matchp = ac_trie_next (m_automata)).size)
     {
-        match = m_matchQueue.front();
-        m_matchQueue.pop();
+        match.position = matchp.position;
+        match.id = matchp.patterns[0].id.u.number;
         return true;
     }
     
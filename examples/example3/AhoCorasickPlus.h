@@ -24,7 +24,6 @@
 #define AHOCORASICKPPW_H_
 
 #include <string>
-#include <queue>
 
 // Forward declarations
 struct ac_trie;
@@ -68,9 +67,6 @@ public:
 private:
     struct ac_trie      *m_automata;
     struct ac_text      *m_acText;
-    std::queue<Match>   m_matchQueue;   // if multiple matches occur in a single
-                                        // position we save them here and return
-                                        // one by one for simplicity
 };
 
 #endif /* AHOCORASICKPPW_H_ */
@@ -92,6 +92,9 @@ int main (int argc, char **argv)
             case ACERR_SUCCESS:
                 printf ("Pattern Added: %s\n", patt->ptext.astring);
                 break;
+            default:
+                printf ("Add pattern failed: %s\n", patt->ptext.astring);
+                break;
         }
     }
 
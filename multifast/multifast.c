@@ -26,6 +26,8 @@
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <errno.h>
 #include "pattern.h"
@@ -36,7 +38,7 @@
 
 /* Program configuration */
 struct program_config config = 
-    {0, WORKING_MODE_SEARCH, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    {0, WORKING_MODE_SEARCH, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 char *get_outfile_name (const char *dir, const char *file);
 int mkpath(const char *path, mode_t mode);
@@ -61,7 +63,7 @@ int main (int argc, char **argv)
     }
 
     /* Read Command line options */
-    while ((clopt = getopt(argc, argv, "P:R:lndxrpfivh")) != -1)
+    while ((clopt = getopt(argc, argv, "P:R:Ij:lndxrpfiwk:Hvh")) != -1)
     {
         switch (clopt)
         {
@@ -72,6 +74,13 @@ int main (int argc, char **argv)
             config.w_mode = WORKING_MODE_REPLACE;
             config.output_dir = optarg;
             break;
+        case 'I':
+            config.w_mode = WORKING_MODE_REPLACE;
+            config.in_place = 1;
+            break;
+        case 'j':
+            config.threads = atol(optarg);
+            break;
         case 'l':
             config.lazy_replace = 1;
             break;
@@ -96,6 +105,15 @@ int main (int argc, char **argv)
         case 'i':
             config.insensitive = 1;
             break;
+        case 'w':
+            config.whole_word = 1;
+            break;
+        case 'k':
+            config.prefetch = atol(optarg);
+            break;
+        case 'H':
+            config.huge_pages = 1;
+            break;
         case 'v':
             config.verbosity = 1;
             break;
@@ -132,6 +150,21 @@ int main (int argc, char **argv)
         exit(1);
     }
     
+    if (config.threads && (config.w_mode != WORKING_MODE_REPLACE || 
+            config.in_place))
+    {
+        fprintf (stderr, "Switch -j is not applicable. "
+                "It operates in replace mode. Use switch -R\n");
+        exit(1);
+    }
+    
+    if (config.in_place && config.output_dir)
+    {
+        fprintf (stderr, "Switch -I replaces the input files themselves. "
+                "It does not take an output directory\n");
+        exit(1);
+    }
+    
     /* Show the configuration file */
     if(config.verbosity)
     {
@@ -143,7 +176,16 @@ int main (int argc, char **argv)
         exit(1);
     
     if(config.verbosity)
+    {
         printf("Total Patterns: %lu\n", trie->patterns_count);
+        printf("Automaton Size: %lu bytes (%lu bytes before compaction)\n", 
+                (unsigned long) trie->freeze_after, 
+                (unsigned long) trie->freeze_before);
+        print_stats (trie);
+        if (config.huge_pages)
+            printf("Huge Pages: %lu bytes\n", 
+                    (unsigned long) ac_trie_hugepages (trie));
+    }
     
     if (config.w_mode == WORKING_MODE_SEARCH)
     {
@@ -182,6 +224,14 @@ int main (int argc, char **argv)
         for (i = 0; i < config.input_files_num; i++)
         {
             infpath = config.input_files[i];
+            
+            if (config.in_place)
+            {
+                if (!replace_file_inplace (trie, infpath))
+                    printf("Successfully replaced in place: %s\n", infpath);
+                continue;
+            }
+            
             outfpath = get_outfile_name (config.output_dir, infpath);
             
             if (!replace_file (trie, infpath, outfpath))
@@ -189,6 +239,9 @@ int main (int argc, char **argv)
         }
     }
     
+    if (config.verbosity)
+        print_counters (trie);
+    
     /* Release */
     pattern_release ();
     ac_trie_release (trie);
@@ -209,6 +262,7 @@ int search_file (const char *filename, AC_TRIE_t *trie)
     static struct match_param mparm; /* Match parameters */
     ssize_t num_read; /* Number of byes read from input file */
     int keep = 0;
+    int stop = 0;
     
     intext.astring = in_stream_buffer;
     
@@ -243,17 +297,20 @@ int search_file (const char *filename, AC_TRIE_t *trie)
         
         intext.length = num_read;
 
-        /* Handle case sensitivity */
-        if (config.insensitive)
-            lower_case(in_stream_buffer, intext.length);
-
         /* Break loop if call-back function has done its work */
         if (ac_trie_search (trie, &intext, keep, match_handler, &mparm))
+        {
+            stop = 1;
             break;
+        }
         
         keep = 1;
         
     } while (num_read == STREAM_BUFFER_SIZE);
+    
+    /* Report the match held back at the end of the file, if any */
+    if (!stop)
+        ac_trie_search_flush (trie, match_handler, &mparm);
 
     close (fd_input);
 
@@ -274,8 +331,8 @@ int replace_file (AC_TRIE_t *trie, const char *infile, const char *outfile)
     ssize_t num_read; /* Number of byes read from input file */
     struct stat file_stat;
     MF_REPLACE_MODE_t rpmod = MF_REPLACE_MODE_DEFAULT;
-    
-    intext.astring = in_stream_buffer;
+    void *mapped;
+    int ret;
 
     /* Open input file */
     if (!strcmp(config.input_files[0], "-"))
@@ -323,6 +380,53 @@ int replace_file (AC_TRIE_t *trie, const char *infile, const char *outfile)
     uparm.total_match = 0;
     uparm.fname = NULL; /* note used */
     uparm.out_file_d = fd_output;
+    uparm.failed = 0;
+    
+    if (config.lazy_replace)
+        rpmod = MF_REPLACE_MODE_LAZY;
+    
+    /* The parallel replacement reads the whole file, which is mapped */
+    if (config.threads > 1 && fd_input != 0 && file_stat.st_size > 0)
+    {
+        mapped = mmap (NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, 
+                fd_input, 0);
+        
+        if (mapped != MAP_FAILED)
+        {
+            intext.astring = (AC_ALPHABET_t *) mapped;
+            intext.length = file_stat.st_size;
+            
+            ret = multifast_replace_parallel (trie, &intext, rpmod, 
+                    (unsigned int) config.threads, replace_listener, &uparm);
+            
+            munmap (mapped, file_stat.st_size);
+            close (fd_input);
+            close (fd_output);
+            
+            if (ret)
+            {
+                /* Part of the output may have been written; do not leave a 
+                 * truncated file behind */
+                if (outfile)
+                    unlink (outfile);
+                
+                fprintf(stderr, "Cannot replace '%s' on %ld threads\n", 
+                        infile, config.threads);
+                return -1;
+            }
+            
+            if (uparm.failed)
+            {
+                fprintf(stderr, "Error while writing to '%s'\n", 
+                        outfile ? outfile : "stdout");
+                return -1;
+            }
+            
+            return 0;
+        }
+    }
+    
+    intext.astring = in_stream_buffer;
     
     /* loop to load and search the input file repeatedly, chunk by chunk */
     do
@@ -341,15 +445,8 @@ int replace_file (AC_TRIE_t *trie, const char *infile, const char *outfile)
             break;
         
         intext.length = num_read;
-
-        /* Handle case sensitivity */
-        if (config.insensitive)
-            lower_case(in_stream_buffer, num_read);
-
-        if (config.lazy_replace)
-            rpmod = MF_REPLACE_MODE_LAZY;
         
-        if (multifast_replace (trie, &intext, rpmod, 
+        if (multifast_replacev (trie, &intext, rpmod, 
                 replace_listener, &uparm))
             /* Break loop if call-back function has done its work */
             break;
@@ -360,6 +457,13 @@ int replace_file (AC_TRIE_t *trie, const char *infile, const char *outfile)
 
     close (fd_input);
     close (fd_output);
+    
+    if (uparm.failed)
+    {
+        fprintf(stderr, "Error while writing to '%s'\n", 
+                outfile ? outfile : "stdout");
+        return -1;
+    }
 
     return 0;
 }
@@ -368,11 +472,80 @@ int replace_file (AC_TRIE_t *trie, const char *infile, const char *outfile)
  * FUNCTION
  *****************************************************************************/
 
-void lower_case (char *s, size_t l)
+int replace_file_inplace (AC_TRIE_t *trie, const char *infile)
 {
-    size_t i;
-    for(i = 0; i < l; i++)
-        s[i] = tolower(s[i]);
+    int fd_input; /* Input file descriptor */
+    AC_TEXT_t intext; /* The mapped file */
+    struct stat file_stat;
+    void *mapped;
+    int ret;
+    
+    if ((fd_input = open(infile, O_RDWR)) == -1)
+    {
+        fprintf(stderr, "Cannot open '%s' for reading and writing\n", infile);
+        return -1;
+    }
+    
+    if (fstat(fd_input, &file_stat))
+    { 
+        fprintf(stderr, "Cannot get file stat for '%s'\n", infile);
+        close(fd_input);
+        return -1; 
+    }
+    
+    if (!S_ISREG(file_stat.st_mode))
+    {
+        fprintf(stderr, "Only regular files are replaced in place: "
+                "skipped '%s'\n", infile);
+        close(fd_input);
+        return -1;
+    }
+    
+    if (file_stat.st_size == 0)
+    {
+        close(fd_input);
+        return 0;
+    }
+    
+    /* The output is written over the mapped file, which is then cut to the 
+     * length of the output */
+    mapped = mmap (NULL, file_stat.st_size, PROT_READ|PROT_WRITE, 
+            MAP_SHARED, fd_input, 0);
+    
+    if (mapped == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map '%s'\n", infile);
+        close(fd_input);
+        return -1;
+    }
+    
+    madvise (mapped, file_stat.st_size, MADV_SEQUENTIAL);
+    
+    intext.astring = (AC_ALPHABET_t *) mapped;
+    intext.length = file_stat.st_size;
+    
+    ret = multifast_replace_inplace (trie, &intext);
+    
+    munmap (mapped, file_stat.st_size);
+    
+    if (ret == -3)
+    {
+        fprintf(stderr, "Some replacement is longer than its pattern, "
+                "which can not be replaced in place: skipped '%s'\n", infile);
+        close(fd_input);
+        return -1;
+    }
+    
+    if (ftruncate (fd_input, intext.length))
+    {
+        fprintf(stderr, "Cannot truncate '%s'\n", infile);
+        close(fd_input);
+        return -1;
+    }
+    
+    close(fd_input);
+    
+    return 0;
 }
 
 /******************************************************************************
@@ -492,11 +665,82 @@ char *get_outfile_name (const char *dir, const char *inpath)
 void print_usage (char *progname)
 {
     printf("MultiFast v%s Usage:\n%s "
-            "-P pattern_file [-R out_dir [-l] | -n[d|x]rpvfi] [-h] "
+            "-P pattern_file [-R out_dir [-l] [-j threads] | -I | -n[d|x]rpvfi] [-w] [-k distance] [-H] [-h] "
             "file1 [file2 ...]\n", 
             XSTRINGIFY(MF_VERSION_NUMBER), progname);
 }
 
+/******************************************************************************
+ * FUNCTION
+ *****************************************************************************/
+
+void print_stats (AC_TRIE_t *trie)
+{
+    AC_TRIE_STATS_t stats;
+    size_t i;
+    
+    if (ac_trie_stats (trie, &stats) != ACERR_SUCCESS)
+        return;
+    
+    printf("Nodes: %lu, Edges: %lu, Final Nodes: %lu, Matched Entries: %lu\n", 
+            (unsigned long) stats.nodes_count, 
+            (unsigned long) stats.edges_count, 
+            (unsigned long) stats.final_count, 
+            (unsigned long) stats.matched_count);
+    printf("Depth: max %lu, avg %.2f\n", 
+            (unsigned long) stats.max_depth, stats.avg_depth);
+    printf("Failure Chain: max %lu, avg %.2f\n", 
+            (unsigned long) stats.max_chain, stats.avg_chain);
+    
+    printf("Fan-out:");
+    for (i = 0; i < 257; i++)
+        if (stats.fanout[i])
+            printf(" %lu:%lu", (unsigned long) i, 
+                    (unsigned long) stats.fanout[i]);
+    printf("\n");
+    
+    printf("Failure Chain Lengths:");
+    for (i = 0; i < AC_STATS_CHAIN_BUCKETS; i++)
+        if (stats.chain[i])
+            printf(" %lu%s:%lu", (unsigned long) i, 
+                    (i == AC_STATS_CHAIN_BUCKETS - 1) ? "+" : "", 
+                    (unsigned long) stats.chain[i]);
+    printf("\n");
+    
+    printf("Memory: %lu bytes (nodes %lu, edges %lu, matched %lu, "
+            "strings %lu, other %lu)\n", 
+            (unsigned long) stats.memory_total, 
+            (unsigned long) stats.memory_nodes, 
+            (unsigned long) stats.memory_edges, 
+            (unsigned long) stats.memory_matched, 
+            (unsigned long) stats.memory_strings, 
+            (unsigned long) stats.memory_other);
+}
+
+/******************************************************************************
+ * FUNCTION
+ *****************************************************************************/
+
+void print_counters (AC_TRIE_t *trie)
+{
+    AC_COUNTERS_t counters;
+    
+    /* Only available if the library is built with AC_COUNTERS */
+    if (ac_trie_counters (trie, &counters, NULL) != ACERR_SUCCESS)
+        return;
+    
+    printf("Scanned: %lu bytes (%lu skipped), Transitions: %lu goto, "
+            "%lu failure\n", 
+            (unsigned long) counters.bytes, 
+            (unsigned long) counters.skipped, 
+            (unsigned long) counters.gotos, 
+            (unsigned long) counters.failures);
+    printf("Matches: %lu, Call-backs: %lu (%.3f ms)\n", 
+            (unsigned long) counters.matches, 
+            (unsigned long) counters.callbacks, 
+            counters.callback_ns / 1e6);
+}
+
 /******************************************************************************
  * FUNCTION
  *****************************************************************************/
@@ -543,8 +787,46 @@ int match_handler (AC_MATCH_t *m, void *param)
  * FUNCTION
  *****************************************************************************/
 
-void replace_listener (AC_TEXT_t *text, void *user)
+void replace_listener (const AC_TEXT_t *segments, size_t count, void *user)
 {
-    write (((struct match_param *)user)->out_file_d, 
-            text->astring, text->length);
+    struct match_param *uparm = (struct match_param *) user;
+    struct iovec iov[MF_REPLACEMENT_SEGMENTS];
+    struct iovec *iop = iov;
+    size_t i;
+    ssize_t written;
+    
+    if (uparm->failed)
+        return;
+    
+    /* The unchanged parts of the input are written from where they are */
+    for (i = 0; i < count; i++)
+    {
+        iov[i].iov_base = (void *) segments[i].astring;
+        iov[i].iov_len = segments[i].length;
+    }
+    
+    while (count)
+    {
+        if ((written = writev (uparm->out_file_d, iop, (int) count)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            uparm->failed = 1;
+            return;
+        }
+        
+        /* Skip what is written and resume from the middle of a segment */
+        while (count && (size_t) written >= iop->iov_len)
+        {
+            written -= iop->iov_len;
+            iop++;
+            count--;
+        }
+        
+        if (count)
+        {
+            iop->iov_base = (char *) iop->iov_base + written;
+            iop->iov_len -= written;
+        }
+    }
 }
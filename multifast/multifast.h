@@ -37,7 +37,12 @@ struct program_config
     short find_first;
     short verbosity;
     short insensitive;
+    short whole_word;           /* Match whole words only */
+    long prefetch;              /* Prefetch distance of the search loop */
+    short huge_pages;           /* Keep the automaton in huge pages */
     short lazy_replace;         /* Lazy replace mode */
+    short in_place;             /* Replace the input files themselves */
+    long threads;               /* Threads of the replacement */
     short output_show_item;     /* Item number */
     short output_show_dpos;     /* Start position (decimal) */
     short output_show_xpos;     /* Start position (hex) */
@@ -45,12 +50,14 @@ struct program_config
     short output_show_pattern;  /* Pattern */
 };
 
-void lower_case (char *s, size_t l);
 void print_usage (char *progname);
+void print_stats (AC_TRIE_t *trie);
+void print_counters (AC_TRIE_t *trie);
 int  search_file (const char *filename, AC_TRIE_t *trie);
 int  replace_file (AC_TRIE_t *trie, const char *infile, const char *outfile);
+int  replace_file_inplace (AC_TRIE_t *trie, const char *infile);
 int  match_handler (AC_MATCH_t *m, void *param);
-void replace_listener (AC_TEXT_t *, void *);
+void replace_listener (const AC_TEXT_t *, size_t, void *);
 
 /* Parameter to match_handler */
 struct match_param
@@ -59,6 +66,7 @@ struct match_param
     unsigned long item;
     char *fname;
     int out_file_d;
+    int failed; /* Writing to out_file_d failed */
 };
 
 #endif /* _MULTIFAST_H_ */
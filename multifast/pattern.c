@@ -53,7 +53,7 @@ int pattern_load (const char *infile, AC_TRIE_t **ptrie)
     struct token_s *mytok;
     int readcount, loopguard = 0;
     static enum token_type last_type = ENTOK_NONE;
-    static AC_PATTERN_t last_pattern = {{NULL, 0}, {NULL, 0}, {{0}, 0}};
+    static AC_PATTERN_t last_pattern = {{NULL, 0}, {NULL, 0}, {{0}, 0}, 0};
     
     if ((fd = fopen(infile, "r")) == NULL)
     {
@@ -66,6 +66,18 @@ int pattern_load (const char *infile, AC_TRIE_t **ptrie)
 
     /* Initialize automata */
     trie = ac_trie_create ();
+    
+    /* Handle case sensitivity */
+    if (config.insensitive)
+        ac_trie_setcase (trie, AC_CASE_INSENSITIVE);
+    
+    /* Memory tuning */
+    if (config.huge_pages)
+        ac_trie_setpages (trie, AC_PAGES_HUGE);
+    
+    /* Prefetch tuning */
+    if (config.prefetch > 0)
+        ac_trie_setprefetch (trie, config.prefetch);
 
     /* Main loop to read patterns from pattern file */
     while ((readcount = fread((void*)buffer, 1, READ_BUFFER_SIZE, fd)) > 0)
@@ -99,9 +111,6 @@ int pattern_load (const char *infile, AC_TRIE_t **ptrie)
                 if (last_pattern.id.u.stringy == NULL)
                     pattern_genrep (&last_pattern.id.u.stringy);
                 
-                if (config.insensitive)
-                    lower_case(mytok->value, mytok->length);
-                
                 last_pattern.ptext.astring = mytok->value;
                 last_pattern.ptext.length = mytok->length;
                 pattern_makeacopy (&last_pattern.ptext.astring, 
@@ -147,8 +156,9 @@ int pattern_load (const char *infile, AC_TRIE_t **ptrie)
         return -1;
     }
     
-    /* Finalize the trie */
+    /* Finalize the trie and compact it */
     ac_trie_finalize (trie);
+    ac_trie_freeze (trie);
 
     *ptrie = trie;
 
@@ -178,8 +188,11 @@ void pattern_makeacopy (const AC_ALPHABET_t **astrp, size_t len)
 
 int pattern_addtoac (AC_PATTERN_t *patt)
 {
+    patt->flags = config.whole_word ? 
+        AC_PATTFLAG_WHOLE_WORD : AC_PATTFLAG_NONE;
+    
     /* Add pattern to automata */
-    switch (ac_trie_add (trie, patt, 0))
+    switch (ac_trie_add_flags (trie, patt, 0))
     {
         case ACERR_DUPLICATE_PATTERN:
             printf("WARNINIG: Skip duplicate string: %s\n", 
@@ -0,0 +1,1281 @@
+/*
+ * oracle.c: Differential test of the search and replace paths
+ * This file is part of multifast.
+ *
+    Copyright 2010-2015 Kamiar Kanani <kamiar.kanani@gmail.com>
+
+    multifast is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    multifast is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with multifast.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Every case is a random pattern set and input text. The matches and the
+ * replaced text of a naive matcher are the reference; the library must give
+ * exactly the same with every engine, with and without ac_trie_freeze(), and
+ * through every interface:
+ *
+ *   search      ac_trie_search() and ac_trie_search_flush()
+ *   findnext    ac_trie_settext() and ac_trie_findnext()
+ *   next        ac_trie_settext() and ac_trie_next()
+ *   scan        ac_trie_scan(); only the pattern sets without checks
+ *   normal      multifast_replace() in MF_REPLACE_MODE_NORMAL
+ *   lazy        multifast_replace() in MF_REPLACE_MODE_LAZY
+ *   replacev    multifast_replacev() in both modes
+ *   tobuffer    multifast_replace_tobuffer() in both modes, on the whole
+ *               text, to a growable buffer and to fixed buffers of the
+ *               exact size and one byte short
+ *   inplace     multifast_replace_inplace() on the whole text; only the
+ *               sets with no replacement longer than its pattern
+ *   parallel    multifast_replace_parallel() in both modes, on the whole
+ *               text, with 1 to 4 threads
+ *
+ * Each of them is run on the whole text and on the text cut into chunks of
+ * random sizes, which exercises the state kept between the chunks: the last
+ * node, the history of the boundary checks, the pending match and the
+ * replacement backlog. Then they are run on the chunks once more, with the
+ * state saved by ac_trie_stream_save() and loaded back after each chunk.
+ *
+ * A case is reproduced with the seed and the case number that are printed
+ * when it fails: oracle -s seed -c case -v
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ahocorasick.h"
+
+/* Maximum number of patterns of a case */
+#define ORACLE_PATTERNS 64
+
+/* Maximum length of a pattern and of a replacement */
+#define ORACLE_PATTERN_LENGTH 12
+
+/* Maximum length of the input text */
+#define ORACLE_TEXT_LENGTH 4096
+
+/* The whole text, the text in chunks, and the text in chunks with the
+ * stream state saved and loaded in between */
+static const char *oracle_modes[] = {"whole", "chunked", "saved"};
+
+/* The engines under test */
+static const AC_ENGINE_t oracle_engines[] = {
+    AC_ENGINE_AUTO,
+    AC_ENGINE_AUTOMATON,
+    AC_ENGINE_STARTBYTES,
+    AC_ENGINE_TEDDY,
+    AC_ENGINE_WUMANBER
+};
+
+#define ORACLE_ENGINES (sizeof(oracle_engines) / sizeof(oracle_engines[0]))
+
+/**
+ * A match: the end position in the text and the pattern number
+ */
+struct oracle_match
+{
+    size_t position;
+    unsigned long pattern;
+};
+
+/**
+ * A growing list of matches
+ */
+struct oracle_matches
+{
+    struct oracle_match *list;
+    size_t size;
+    size_t capacity;
+    int disordered; /* The positions went backward */
+};
+
+/**
+ * A growing output text
+ */
+struct oracle_output
+{
+    char *astring;
+    size_t length;
+    size_t capacity;
+};
+
+/**
+ * A test case
+ */
+struct oracle_case
+{
+    AC_ALPHABET_t patterns[ORACLE_PATTERNS][ORACLE_PATTERN_LENGTH];
+    AC_ALPHABET_t replacements[ORACLE_PATTERNS][ORACLE_PATTERN_LENGTH];
+    AC_PATTERN_t patt[ORACLE_PATTERNS];
+    int accepted[ORACLE_PATTERNS];  /* Accepted by ac_trie_add_flags() */
+    size_t count;
+
+    AC_CASE_MODE_t case_mode;
+    int use_map;
+    size_t buffer_size;     /* Replacement buffer size; 0 for the default */
+    AC_ALPHABET_t map[256];
+
+    AC_ALPHABET_t text[ORACLE_TEXT_LENGTH];
+    size_t length;
+};
+
+/* Options */
+static unsigned long long oracle_seed = 1;
+static unsigned long oracle_cases = 2000;
+static long oracle_only = -1;   /* Run only this case */
+static int oracle_verbose = 0;
+
+static unsigned long long oracle_state;
+static unsigned long oracle_variants;
+
+static unsigned long long oracle_random (void);
+static size_t oracle_range (size_t min, size_t max);
+static void oracle_generate (struct oracle_case *c);
+static int  oracle_run (struct oracle_case *c, unsigned long number);
+static int  oracle_equal (struct oracle_case *c, size_t index, size_t pos);
+static int  oracle_passes (struct oracle_case *c, size_t index,
+        size_t start, size_t end);
+static void oracle_naive_search (struct oracle_case *c,
+        struct oracle_matches *out);
+static void oracle_naive_replace (struct oracle_case *c,
+        MF_REPLACE_MODE_t mode, struct oracle_output *out);
+static void oracle_add (struct oracle_matches *thiz, size_t position,
+        unsigned long pattern);
+static void oracle_append (struct oracle_output *thiz, const char *s,
+        size_t length);
+static int  oracle_compare (const void *a, const void *b);
+static int  oracle_check_matches (struct oracle_matches *expected,
+        struct oracle_matches *got, const char *variant);
+static int  oracle_check_output (struct oracle_output *expected,
+        struct oracle_output *got, const char *variant);
+static size_t oracle_chunk (size_t maximum, size_t left);
+static int  oracle_reload (AC_TRIE_t *trie, const char *variant);
+static int  oracle_tobuffer (AC_TRIE_t *trie, struct oracle_case *c,
+        MF_REPLACE_MODE_t mode, struct oracle_output *expected,
+        const char *variant);
+static int  oracle_inplace (AC_TRIE_t *trie, struct oracle_case *c,
+        struct oracle_output *expected, const char *variant);
+static int  oracle_match_handler (AC_MATCH_t *m, void *param);
+static void oracle_replace_listener (AC_TEXT_t *text, void *user);
+static void oracle_segments_listener (const AC_TEXT_t *segments,
+        size_t count, void *user);
+
+/**
+ * @brief Prints the usage of the program
+ *
+ * @param progname
+ *****************************************************************************/
+static void oracle_usage (const char *progname)
+{
+    printf ("Usage: %s [-s seed] [-n cases] [-c case] [-v] [-h]\n",
+            progname);
+}
+
+int main (int argc, char **argv)
+{
+    struct oracle_case *c;
+    unsigned long i, failed = 0;
+    int clopt;
+
+    while ((clopt = getopt (argc, argv, "s:n:c:vh")) != -1)
+    {
+        switch (clopt)
+        {
+            case 's':
+                oracle_seed = strtoull (optarg, NULL, 10);
+                break;
+            case 'n':
+                oracle_cases = strtoul (optarg, NULL, 10);
+                break;
+            case 'c':
+                oracle_only = atol (optarg);
+                break;
+            case 'v':
+                oracle_verbose = 1;
+                break;
+            case 'h':
+            default:
+                oracle_usage (argv[0]);
+                return clopt == 'h' ? 0 : 1;
+        }
+    }
+
+    c = (struct oracle_case *) malloc (sizeof(struct oracle_case));
+
+    for (i = 0; i < oracle_cases; i++)
+    {
+        if (oracle_only >= 0 && i != (unsigned long) oracle_only)
+            continue;
+
+        /* Every case has its own seed, so that a single one can be
+         * reproduced without running the others */
+        oracle_state = oracle_seed * 1000003ULL + i;
+        oracle_generate (c);
+
+        if (oracle_run (c, i))
+        {
+            failed++;
+            printf ("FAILED: seed %llu case %lu; rerun with -s %llu -c %lu "
+                    "-v\n", oracle_seed, i, oracle_seed, i);
+            if (failed >= 10)
+                break;
+        }
+    }
+
+    printf ("%lu cases, %lu variants, %lu failed\n",
+            oracle_only >= 0 ? 1 : i, oracle_variants, failed);
+
+    free (c);
+
+    return failed ? 1 : 0;
+}
+
+/**
+ * @brief Generates the next random number (splitmix64)
+ *
+ * @return
+ *****************************************************************************/
+static unsigned long long oracle_random (void)
+{
+    unsigned long long z = (oracle_state += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Generates a random number in the given range
+ *
+ * @param min
+ * @param max
+ * @return a number between min and max, inclusive
+ *****************************************************************************/
+static size_t oracle_range (size_t min, size_t max)
+{
+    return min + (size_t) (oracle_random () % (max - min + 1));
+}
+
+/**
+ * @brief Generates a test case
+ *
+ * The alphabets are small, so that the patterns overlap, share prefixes and
+ * occur often in the text.
+ *
+ * @param c receives the case
+ *****************************************************************************/
+static void oracle_generate (struct oracle_case *c)
+{
+    static const char *alphabets[] = {
+        "ab",
+        "ab \nA_",
+        "abcAB  \n.x",
+        "the quick brown fox\n",
+    };
+    AC_ALPHABET_t binary[256];
+    const AC_ALPHABET_t *alphabet;
+    size_t i, j, size, length, min_length, subset;
+
+    switch (oracle_range (0, 4))
+    {
+        case 4:
+            /* Random bytes, including 0 and the upper half */
+            size = oracle_range (1, 256);
+            for (i = 0; i < size; i++)
+                binary[i] = (AC_ALPHABET_t) (oracle_random () & 0xFF);
+            alphabet = binary;
+            break;
+
+        default:
+            alphabet = alphabets[oracle_range (0, 3)];
+            size = strlen (alphabet);
+            break;
+    }
+
+    /* The patterns may use only a part of the alphabet of the text */
+    subset = (size > 16) ? oracle_range (size / 4, size) : size;
+
+    c->case_mode = (AC_CASE_MODE_t) oracle_range (0, 2);
+
+    c->use_map = (oracle_range (0, 3) == 0);
+    for (i = 0; i < 256; i++)
+        c->map[i] = (AC_ALPHABET_t) i;
+    if (c->use_map)
+    {
+        c->map['b'] = 'a';
+        c->map['x'] = '.';
+        c->map[' '] = '\n';
+        c->map['B'] = 'c';
+    }
+
+    c->count = oracle_range (1, ORACLE_PATTERNS);
+    min_length = oracle_range (0, 2) ? 1 : oracle_range (2, 8);
+
+    for (i = 0; i < c->count; i++)
+    {
+        length = oracle_range (min_length,
+                min_length + 3 < ORACLE_PATTERN_LENGTH ?
+                min_length + 3 : ORACLE_PATTERN_LENGTH);
+
+        for (j = 0; j < length; j++)
+            c->patterns[i][j] = alphabet[oracle_range (0, subset - 1)];
+
+        memset (&c->patt[i], 0, sizeof(AC_PATTERN_t));
+        c->patt[i].ptext.astring = c->patterns[i];
+        c->patt[i].ptext.length = length;
+        c->patt[i].id.u.number = i;
+        c->patt[i].id.type = AC_PATTID_TYPE_NUMBER;
+
+        /* Shrinking, equal and growing replacements; some patterns are
+         * only searched, not replaced */
+        if (oracle_range (0, 3))
+        {
+            length = oracle_range (0, ORACLE_PATTERN_LENGTH);
+            for (j = 0; j < length; j++)
+                c->replacements[i][j] = '0' + oracle_range (0, 9);
+            c->patt[i].rtext.astring = c->replacements[i];
+            c->patt[i].rtext.length = length;
+        }
+
+        if (oracle_range (0, 2) == 0)
+            c->patt[i].flags = oracle_range (0, 15);
+
+        if (c->case_mode == AC_CASE_PER_PATTERN && oracle_range (0, 1))
+            c->patt[i].flags |= AC_PATTFLAG_NOCASE;
+    }
+
+    c->length = oracle_range (0, ORACLE_TEXT_LENGTH);
+    for (i = 0; i < c->length; i++)
+        c->text[i] = alphabet[oracle_range (0, size - 1)];
+
+    /* Small buffers make the replacement pass the long factors directly */
+    c->buffer_size = oracle_range (0, 1) ? 0 : oracle_range (1, 64);
+
+    /* No replacement longer than its pattern, which can be replaced in
+     * place */
+    if (oracle_range (0, 2) == 0)
+        for (i = 0; i < c->count; i++)
+            if (c->patt[i].rtext.length > c->patt[i].ptext.length)
+                c->patt[i].rtext.length = c->patt[i].ptext.length;
+}
+
+/**
+ * @brief Runs all the variants of a case against the naive matcher
+ *
+ * @param c the case
+ * @param number the case number
+ * @return 0 if they all agree, 1 otherwise
+ *****************************************************************************/
+static int oracle_run (struct oracle_case *c, unsigned long number)
+{
+    struct oracle_matches expected, got;
+    struct oracle_output expected_normal, expected_lazy, output;
+    struct oracle_output *expected_output;
+    AC_TRIE_t *trie;
+    AC_TEXT_t chunk;
+    AC_MATCH_t match;
+    AC_SCANNER_t scanner;
+    MF_REPLACE_MODE_t mode;
+    char variant[128];
+    size_t e, i, offset, length, maximum;
+    int frozen, chunked, keep, accepted, ret, rep, vector, failed = 0;
+
+    memset (&expected, 0, sizeof(expected));
+    memset (&got, 0, sizeof(got));
+    memset (&expected_normal, 0, sizeof(expected_normal));
+    memset (&expected_lazy, 0, sizeof(expected_lazy));
+    memset (&output, 0, sizeof(output));
+
+    for (e = 0; e < ORACLE_ENGINES && !failed; e++)
+    {
+        for (frozen = 0; frozen < 2 && !failed; frozen++)
+        {
+            trie = ac_trie_create ();
+            ac_trie_setcase (trie, c->case_mode);
+            if (c->use_map)
+                ac_trie_setmap (trie, c->map);
+            if (ac_trie_setbuffer (trie, c->buffer_size) != ACERR_SUCCESS ||
+                    ac_trie_setbuffer (trie, MF_REPLACEMENT_BUFFER_MAX + 1) !=
+                    ACERR_BUFFER_SIZE)
+            {
+                printf ("buffer size %lu: wrong status\n",
+                        (unsigned long) c->buffer_size);
+                failed = 1;
+            }
+            ac_trie_setengine (trie, oracle_engines[e]);
+
+            for (i = 0; i < c->count; i++)
+            {
+                accepted = (ac_trie_add_flags (trie, &c->patt[i], i % 2) ==
+                        ACERR_SUCCESS);
+
+                if (e == 0 && frozen == 0)
+                    c->accepted[i] = accepted;
+                else if (accepted != c->accepted[i])
+                {
+                    printf ("engine %d: pattern %lu is %s\n",
+                            (int) oracle_engines[e], (unsigned long) i,
+                            accepted ? "accepted" : "rejected");
+                    failed = 1;
+                }
+            }
+
+            ac_trie_finalize (trie);
+            if (frozen)
+                ac_trie_freeze (trie);
+
+            if (e == 0 && frozen == 0)
+            {
+                oracle_naive_search (c, &expected);
+                oracle_naive_replace (c, MF_REPLACE_MODE_NORMAL,
+                        &expected_normal);
+                oracle_naive_replace (c, MF_REPLACE_MODE_LAZY,
+                        &expected_lazy);
+            }
+
+            for (chunked = 0; chunked < 3 && !failed; chunked++)
+            {
+                /* Chunks of up to 1, a few, or many bytes */
+                maximum = chunked ? oracle_range (1, 3) == 1 ? 1 :
+                        oracle_range (2, 300) : 0;
+
+                /* ac_trie_search() */
+                snprintf (variant, sizeof(variant), "engine %d%s %s search",
+                        (int) oracle_engines[e], frozen ? " frozen" : "",
+                        oracle_modes[chunked]);
+
+                got.size = got.disordered = 0;
+                offset = keep = 0;
+                do
+                {
+                    chunk.astring = c->text + offset;
+                    chunk.length = oracle_chunk (maximum, c->length - offset);
+                    ac_trie_search (trie, &chunk, keep,
+                            oracle_match_handler, &got);
+                    offset += chunk.length;
+                    if (chunked == 2)
+                        failed |= oracle_reload (trie, variant);
+                    keep = 1;
+                }
+                while (offset < c->length);
+                ac_trie_search_flush (trie, oracle_match_handler, &got);
+
+                failed |= oracle_check_matches (&expected, &got, variant);
+
+                /* ac_trie_findnext() */
+                snprintf (variant, sizeof(variant), "engine %d%s %s findnext",
+                        (int) oracle_engines[e], frozen ? " frozen" : "",
+                        oracle_modes[chunked]);
+
+                got.size = got.disordered = 0;
+                offset = keep = 0;
+                do
+                {
+                    chunk.astring = c->text + offset;
+                    chunk.length = oracle_chunk (maximum, c->length - offset);
+                    ac_trie_settext (trie, &chunk, keep);
+                    while ((match = ac_trie_findnext (trie)).size)
+                        oracle_match_handler (&match, &got);
+                    offset += chunk.length;
+                    if (chunked == 2)
+                        failed |= oracle_reload (trie, variant);
+                    keep = 1;
+                }
+                while (offset < c->length);
+                ac_trie_search_flush (trie, oracle_match_handler, &got);
+
+                failed |= oracle_check_matches (&expected, &got, variant);
+
+                /* ac_trie_next() */
+                snprintf (variant, sizeof(variant), "engine %d%s %s next",
+                        (int) oracle_engines[e], frozen ? " frozen" : "",
+                        oracle_modes[chunked]);
+
+                got.size = got.disordered = 0;
+                offset = keep = 0;
+                do
+                {
+                    chunk.astring = c->text + offset;
+                    chunk.length = oracle_chunk (maximum, c->length - offset);
+                    ac_trie_settext (trie, &chunk, keep);
+                    while ((match = ac_trie_next (trie)).size)
+                        oracle_match_handler (&match, &got);
+
+                    /* The text is done; it is not searched again */
+                    if (ac_trie_next (trie).size)
+                        oracle_add (&got, 0, c->count);
+
+                    offset += chunk.length;
+                    if (chunked == 2)
+                        failed |= oracle_reload (trie, variant);
+                    keep = 1;
+                }
+                while (offset < c->length);
+
+                /* The end of the input */
+                ac_trie_settext (trie, NULL, 1);
+                while ((match = ac_trie_next (trie)).size)
+                    oracle_match_handler (&match, &got);
+
+                failed |= oracle_check_matches (&expected, &got, variant);
+
+                /* ac_trie_scan() */
+                snprintf (variant, sizeof(variant), "engine %d%s %s scan",
+                        (int) oracle_engines[e], frozen ? " frozen" : "",
+                        oracle_modes[chunked]);
+
+                got.size = got.disordered = 0;
+                offset = 0;
+                ret = 0;
+                ac_scanner_init (&scanner, &got);
+                do
+                {
+                    chunk.astring = c->text + offset;
+                    chunk.length = oracle_chunk (maximum, c->length - offset);
+                    ac_scanner_settext (&scanner, &chunk);
+                    ret = ac_trie_scan (trie, &scanner, 1,
+                            oracle_match_handler);
+                    offset += chunk.length;
+                }
+                while (offset < c->length && ret == 0);
+
+                /* Only the pattern sets without checks can be scanned */
+                if (ret != -2)
+                {
+                    if (ret != 0)
+                    {
+                        printf ("%s: returned %d\n", variant, ret);
+                        failed = 1;
+                    }
+                    failed |= oracle_check_matches (&expected, &got, variant);
+                }
+
+                /* multifast_replace() and multifast_replacev() */
+                for (rep = 0; rep < 4 && !failed; rep++)
+                {
+                    mode = (rep % 2) ?
+                            MF_REPLACE_MODE_LAZY : MF_REPLACE_MODE_NORMAL;
+                    vector = rep / 2;
+
+                    snprintf (variant, sizeof(variant),
+                            "engine %d%s %s %s %s",
+                            (int) oracle_engines[e], frozen ? " frozen" : "",
+                            oracle_modes[chunked],
+                            mode == MF_REPLACE_MODE_LAZY ? "lazy" : "normal",
+                            vector ? "replacev" : "replace");
+
+                    expected_output = (mode == MF_REPLACE_MODE_LAZY) ?
+                            &expected_lazy : &expected_normal;
+
+                    /* multifast_replace() continues the stream of the
+                     * trie; a new one is started after the search */
+                    chunk.length = 0;
+                    ac_trie_settext (trie, &chunk, 0);
+
+                    output.length = 0;
+                    offset = 0;
+                    do
+                    {
+                        chunk.astring = c->text + offset;
+                        length = oracle_chunk (maximum, c->length - offset);
+                        chunk.length = length;
+                        if (vector)
+                            multifast_replacev (trie, &chunk, mode,
+                                    oracle_segments_listener, &output);
+                        else
+                            multifast_replace (trie, &chunk, mode,
+                                    oracle_replace_listener, &output);
+                        offset += length;
+                        if (chunked == 2)
+                            failed |= oracle_reload (trie, variant);
+                    }
+                    while (offset < c->length);
+                    multifast_rep_flush (trie, 0);
+
+                    /* Without any replacement pattern, the replace is a
+                     * no-op and nothing is written */
+                    if (trie->repdata.has_replacement)
+                        failed |= oracle_check_output (expected_output,
+                                &output, variant);
+                }
+            }
+
+            /* multifast_replace_tobuffer() */
+            for (rep = 0; rep < 2 && !failed; rep++)
+            {
+                mode = rep ? MF_REPLACE_MODE_LAZY : MF_REPLACE_MODE_NORMAL;
+
+                snprintf (variant, sizeof(variant),
+                        "engine %d%s whole %s tobuffer",
+                        (int) oracle_engines[e], frozen ? " frozen" : "",
+                        rep ? "lazy" : "normal");
+
+                failed |= oracle_tobuffer (trie, c, mode,
+                        rep ? &expected_lazy : &expected_normal, variant);
+            }
+
+            /* multifast_replace_parallel() */
+            for (rep = 0; rep < 2 && !failed; rep++)
+            {
+                mode = rep ? MF_REPLACE_MODE_LAZY : MF_REPLACE_MODE_NORMAL;
+                i = oracle_range (1, 4);
+
+                snprintf (variant, sizeof(variant),
+                        "engine %d%s whole %s parallel %lu",
+                        (int) oracle_engines[e], frozen ? " frozen" : "",
+                        rep ? "lazy" : "normal", (unsigned long) i);
+
+                chunk.astring = c->text;
+                chunk.length = c->length;
+                output.length = 0;
+                ret = multifast_replace_parallel (trie, &chunk, mode,
+                        (unsigned int) i, oracle_segments_listener, &output);
+
+                if (ret != (trie->repdata.has_replacement ? 0 : -2))
+                {
+                    printf ("%s: returned %d\n", variant, ret);
+                    failed = 1;
+                }
+                else if (ret == 0)
+                    failed |= oracle_check_output (rep ?
+                            &expected_lazy : &expected_normal,
+                            &output, variant);
+            }
+
+            /* multifast_replace_inplace(), which is lazy */
+            if (!failed)
+            {
+                snprintf (variant, sizeof(variant),
+                        "engine %d%s whole lazy inplace",
+                        (int) oracle_engines[e], frozen ? " frozen" : "");
+
+                failed |= oracle_inplace (trie, c, &expected_lazy, variant);
+            }
+
+            ac_trie_release (trie);
+        }
+    }
+
+    if (failed && oracle_verbose)
+    {
+        printf ("case %lu: %lu patterns, case mode %d, map %d, text %lu "
+                "bytes, buffer %lu\n", number, (unsigned long) c->count,
+                (int) c->case_mode, c->use_map, (unsigned long) c->length,
+                (unsigned long) c->buffer_size);
+
+        for (i = 0; i < c->count; i++)
+        {
+            printf ("  %2lu%s flags 0x%02x \"", (unsigned long) i,
+                    c->accepted[i] ? " " : "x", c->patt[i].flags);
+            fwrite (c->patt[i].ptext.astring, 1, c->patt[i].ptext.length,
+                    stdout);
+            printf ("\" -> ");
+            if (c->patt[i].rtext.astring)
+            {
+                printf ("\"");
+                fwrite (c->patt[i].rtext.astring, 1,
+                        c->patt[i].rtext.length, stdout);
+                printf ("\"\n");
+            }
+            else
+                printf ("none\n");
+        }
+    }
+
+    free (expected.list);
+    free (got.list);
+    free (expected_normal.astring);
+    free (expected_lazy.astring);
+    free (output.astring);
+
+    return failed;
+}
+
+/**
+ * @brief Compares a pattern with the text the way the trie does: through
+ * the user mapping, then case folding
+ *
+ * @param c the case
+ * @param index the pattern number
+ * @param pos the start of the pattern in the text
+ * @return 1 if the pattern is at the position, 0 otherwise
+ *****************************************************************************/
+static int oracle_equal (struct oracle_case *c, size_t index, size_t pos)
+{
+    AC_PATTERN_t *patt = &c->patt[index];
+    unsigned char a, b;
+    int nocase;
+    size_t i;
+
+    nocase = (c->case_mode == AC_CASE_INSENSITIVE) ||
+            (c->case_mode == AC_CASE_PER_PATTERN &&
+            (patt->flags & AC_PATTFLAG_NOCASE));
+
+    for (i = 0; i < patt->ptext.length; i++)
+    {
+        a = (unsigned char) c->map[(unsigned char) c->text[pos + i]];
+        b = (unsigned char) c->map[(unsigned char) patt->ptext.astring[i]];
+
+        if (nocase)
+        {
+            if (a >= 'A' && a <= 'Z')
+                a += 'a' - 'A';
+            if (b >= 'A' && b <= 'Z')
+                b += 'a' - 'A';
+        }
+
+        if (a != b)
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Checks if a byte belongs to a word
+ *
+ * @param alpha
+ * @return 1 if it is a word byte, 0 otherwise
+ *****************************************************************************/
+static int oracle_isword (AC_ALPHABET_t alpha)
+{
+    unsigned char c = (unsigned char) alpha;
+
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+/**
+ * @brief Checks if an occurrence of a pattern passes its boundary flags.
+ * The boundaries are checked on the original bytes of the text.
+ *
+ * @param c the case
+ * @param index the pattern number
+ * @param start the start of the occurrence
+ * @param end the end of the occurrence
+ * @return 1 if it passes, 0 otherwise
+ *****************************************************************************/
+static int oracle_passes (struct oracle_case *c, size_t index,
+        size_t start, size_t end)
+{
+    unsigned int flags = c->patt[index].flags;
+
+    if ((flags & AC_PATTFLAG_WORD_START) && start > 0 &&
+            oracle_isword (c->text[start - 1]))
+        return 0;
+    if ((flags & AC_PATTFLAG_WORD_END) && end < c->length &&
+            oracle_isword (c->text[end]))
+        return 0;
+    if ((flags & AC_PATTFLAG_LINE_START) && start > 0 &&
+            c->text[start - 1] != '\n')
+        return 0;
+    if ((flags & AC_PATTFLAG_LINE_END) && end < c->length &&
+            c->text[end] != '\n' && c->text[end] != '\r')
+        return 0;
+
+    return 1;
+}
+
+/**
+ * @brief Finds all the occurrences of all the patterns, one by one
+ *
+ * @param c the case
+ * @param out receives the matches, sorted
+ *****************************************************************************/
+static void oracle_naive_search (struct oracle_case *c,
+        struct oracle_matches *out)
+{
+    size_t end, i, length;
+
+    out->size = 0;
+
+    for (end = 1; end <= c->length; end++)
+    {
+        for (i = 0; i < c->count; i++)
+        {
+            length = c->patt[i].ptext.length;
+
+            if (!c->accepted[i] || length > end)
+                continue;
+
+            if (oracle_equal (c, i, end - length) &&
+                    oracle_passes (c, i, end - length, end))
+                oracle_add (out, end, i);
+        }
+    }
+
+    if (out->size)
+        qsort (out->list, out->size, sizeof(struct oracle_match),
+                oracle_compare);
+}
+
+/**
+ * @brief Replaces the patterns in the text, by the definition of the
+ * replace modes
+ *
+ * At each end position, the longest pattern with a replacement is the
+ * nominee. In the normal mode, a nominee drops the previous nominees that
+ * start at or after its start: they are its factors. In the lazy mode, a
+ * nominee that overlaps the previous one is dropped.
+ *
+ * @param c the case
+ * @param mode the replace mode
+ * @param out receives the replaced text
+ *****************************************************************************/
+static void oracle_naive_replace (struct oracle_case *c,
+        MF_REPLACE_MODE_t mode, struct oracle_output *out)
+{
+    size_t *starts, *patterns, count = 0, end, start, cursor, i, best, k;
+    size_t length;
+
+    starts = (size_t *) malloc ((c->length + 1) * sizeof(size_t));
+    patterns = (size_t *) malloc ((c->length + 1) * sizeof(size_t));
+
+    out->length = 0;
+
+    for (end = 1; end <= c->length; end++)
+    {
+        best = c->count;
+
+        for (i = 0; i < c->count; i++)
+        {
+            length = c->patt[i].ptext.length;
+
+            if (!c->accepted[i] || !c->patt[i].rtext.astring ||
+                    length > end)
+                continue;
+
+            if (oracle_equal (c, i, end - length) &&
+                    oracle_passes (c, i, end - length, end) &&
+                    (best == c->count ||
+                    length > c->patt[best].ptext.length))
+                best = i;
+        }
+
+        if (best == c->count)
+            continue;
+
+        start = end - c->patt[best].ptext.length;
+
+        if (mode == MF_REPLACE_MODE_LAZY)
+        {
+            if (count && start < starts[count - 1] +
+                    c->patt[patterns[count - 1]].ptext.length)
+                continue;
+        }
+        else
+        {
+            while (count && start <= starts[count - 1])
+                count--;
+        }
+
+        starts[count] = start;
+        patterns[count] = best;
+        count++;
+    }
+
+    cursor = 0;
+
+    for (k = 0; k < count; k++)
+    {
+        if (starts[k] > cursor)
+            oracle_append (out, c->text + cursor, starts[k] - cursor);
+
+        oracle_append (out, c->patt[patterns[k]].rtext.astring,
+                c->patt[patterns[k]].rtext.length);
+
+        cursor = starts[k] + c->patt[patterns[k]].ptext.length;
+    }
+
+    if (c->length > cursor)
+        oracle_append (out, c->text + cursor, c->length - cursor);
+
+    free (starts);
+    free (patterns);
+}
+
+/**
+ * @brief Adds a match to the list
+ *
+ * @param thiz
+ * @param position
+ * @param pattern
+ *****************************************************************************/
+static void oracle_add (struct oracle_matches *thiz, size_t position,
+        unsigned long pattern)
+{
+    if (thiz->size == thiz->capacity)
+    {
+        thiz->capacity = thiz->capacity ? 2 * thiz->capacity : 1024;
+        thiz->list = (struct oracle_match *) realloc (thiz->list,
+                thiz->capacity * sizeof(struct oracle_match));
+    }
+
+    if (thiz->size && position < thiz->list[thiz->size - 1].position)
+        thiz->disordered = 1;
+
+    thiz->list[thiz->size].position = position;
+    thiz->list[thiz->size].pattern = pattern;
+    thiz->size++;
+}
+
+/**
+ * @brief Appends to the output text
+ *
+ * @param thiz
+ * @param s
+ * @param length
+ *****************************************************************************/
+static void oracle_append (struct oracle_output *thiz, const char *s,
+        size_t length)
+{
+    if (length == 0)
+        return;
+
+    if (thiz->length + length > thiz->capacity)
+    {
+        thiz->capacity = 2 * (thiz->length + length) + 1024;
+        thiz->astring = (char *) realloc (thiz->astring, thiz->capacity);
+    }
+
+    memcpy (thiz->astring + thiz->length, s, length);
+    thiz->length += length;
+}
+
+/**
+ * @brief Orders the matches by position, then by pattern
+ *****************************************************************************/
+static int oracle_compare (const void *a, const void *b)
+{
+    const struct oracle_match *x = (const struct oracle_match *) a;
+    const struct oracle_match *y = (const struct oracle_match *) b;
+
+    if (x->position != y->position)
+        return x->position < y->position ? -1 : 1;
+    if (x->pattern != y->pattern)
+        return x->pattern < y->pattern ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief Compares the matches of a variant with the reference
+ *
+ * The matches must be reported in the order of their positions; the order
+ * of the patterns of one position is not specified.
+ *
+ * @param expected the matches of the naive matcher, sorted
+ * @param got the matches of the variant
+ * @param variant the name of the variant
+ * @return 0 if they are the same, 1 otherwise
+ *****************************************************************************/
+static int oracle_check_matches (struct oracle_matches *expected,
+        struct oracle_matches *got, const char *variant)
+{
+    size_t i;
+
+    oracle_variants++;
+
+    if (got->disordered)
+    {
+        printf ("%s: the matches are not in order\n", variant);
+        return 1;
+    }
+
+    if (got->size)
+        qsort (got->list, got->size, sizeof(struct oracle_match),
+                oracle_compare);
+
+    for (i = 0; i < expected->size && i < got->size; i++)
+        if (oracle_compare (&expected->list[i], &got->list[i]))
+            break;
+
+    if (i == expected->size && i == got->size)
+        return 0;
+
+    printf ("%s: %lu matches, expected %lu; first difference at match %lu",
+            variant, (unsigned long) got->size,
+            (unsigned long) expected->size, (unsigned long) i);
+
+    if (i < expected->size)
+        printf ("; expected pattern %lu at %lu",
+                expected->list[i].pattern,
+                (unsigned long) expected->list[i].position);
+    if (i < got->size)
+        printf ("; got pattern %lu at %lu", got->list[i].pattern,
+                (unsigned long) got->list[i].position);
+    printf ("\n");
+
+    return 1;
+}
+
+/**
+ * @brief Compares the replaced text of a variant with the reference
+ *
+ * @param expected the text of the naive replace
+ * @param got the text of the variant
+ * @param variant the name of the variant
+ * @return 0 if they are the same, 1 otherwise
+ *****************************************************************************/
+static int oracle_check_output (struct oracle_output *expected,
+        struct oracle_output *got, const char *variant)
+{
+    size_t i;
+
+    oracle_variants++;
+
+    for (i = 0; i < expected->length && i < got->length; i++)
+        if (expected->astring[i] != got->astring[i])
+            break;
+
+    if (i == expected->length && i == got->length)
+        return 0;
+
+    printf ("%s: %lu bytes, expected %lu; first difference at byte %lu\n",
+            variant, (unsigned long) got->length,
+            (unsigned long) expected->length, (unsigned long) i);
+
+    if (oracle_verbose)
+    {
+        printf ("  expected: \"");
+        fwrite (expected->astring, 1, expected->length, stdout);
+        printf ("\"\n  got:      \"");
+        fwrite (got->astring, 1, got->length, stdout);
+        printf ("\"\n");
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Draws the size of the next chunk
+ *
+ * @param maximum the maximum size; 0 for the rest of the text
+ * @param left the bytes left in the text
+ * @return
+ *****************************************************************************/
+static size_t oracle_chunk (size_t maximum, size_t left)
+{
+    size_t size;
+
+    if (maximum == 0 || left == 0)
+        return left;
+
+    size = oracle_range (1, maximum);
+
+    return size < left ? size : left;
+}
+
+/**
+ * @brief Saves the stream state of the trie, spoils it, and loads it back
+ *
+ * @param trie
+ * @param variant the name of the variant, for the error message
+ * @return 0 on success, 1 otherwise
+ *****************************************************************************/
+static int oracle_reload (AC_TRIE_t *trie, const char *variant)
+{
+    static char state[16384];
+    size_t size = sizeof(state), expected = ac_trie_stream_size (trie);
+    AC_STATUS_t status;
+
+    if ((status = ac_trie_stream_save (trie, state, &size)) != ACERR_SUCCESS
+            || size != expected)
+    {
+        printf ("%s: save returned %d, size %lu of %lu\n", variant,
+                (int) status, (unsigned long) size, (unsigned long) expected);
+        return 1;
+    }
+
+    /* Start another stream and spoil the buffers that the state refers to,
+     * so that nothing survives but what is loaded */
+    ac_trie_stream_load (trie, NULL, 0);
+    if (trie->history.astring)
+        memset ((char *) trie->history.astring, 0x5A,
+                AC_PATTRN_MAX_LENGTH + 1);
+    if (trie->repdata.backlog.astring)
+        memset ((char *) trie->repdata.backlog.astring, 0x5A,
+                AC_PATTRN_MAX_LENGTH);
+
+    if ((status = ac_trie_stream_load (trie, state, size)) != ACERR_SUCCESS)
+    {
+        printf ("%s: load returned %d\n", variant, (int) status);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Replaces the whole text with multifast_replace_tobuffer(), to a
+ * growable buffer, and to fixed buffers of the exact size and one byte short
+ *
+ * @param trie
+ * @param c the case
+ * @param mode
+ * @param expected the expected output
+ * @param variant the name of the variant, for the error message
+ * @return 0 on success, 1 otherwise
+ *****************************************************************************/
+static int oracle_tobuffer (AC_TRIE_t *trie, struct oracle_case *c,
+        MF_REPLACE_MODE_t mode, struct oracle_output *expected,
+        const char *variant)
+{
+    struct oracle_output got;
+    MF_OUTPUT_t output;
+    AC_TEXT_t text;
+    int ret, failed = 0;
+
+    text.astring = c->text;
+    text.length = c->length;
+
+    /* Growable, from nothing */
+    output.astring = NULL;
+    output.capacity = 0;
+    output.growable = 1;
+
+    if ((ret = multifast_replace_tobuffer (trie, &text, mode, &output)) != 0)
+    {
+        printf ("%s: growable returned %d\n", variant, ret);
+        failed = 1;
+    }
+    else
+    {
+        got.astring = (char *) output.astring;
+        got.length = output.length;
+        failed |= oracle_check_output (expected, &got, variant);
+    }
+    free (output.astring);
+
+    /* Fixed, of the exact size; the sanitizers catch an overflow */
+    output.capacity = expected->length;
+    output.astring = (AC_ALPHABET_t *) malloc (output.capacity ?
+            output.capacity : 1);
+    output.growable = 0;
+
+    if ((ret = multifast_replace_tobuffer (trie, &text, mode, &output)) != 0)
+    {
+        printf ("%s: fixed returned %d\n", variant, ret);
+        failed = 1;
+    }
+    else
+    {
+        got.astring = (char *) output.astring;
+        got.length = output.length;
+        failed |= oracle_check_output (expected, &got, variant);
+    }
+
+    /* Fixed, one byte short: the needed size is returned */
+    if (expected->length && !failed)
+    {
+        output.capacity = expected->length - 1;
+        ret = multifast_replace_tobuffer (trie, &text, mode, &output);
+
+        if (ret != -3 || output.length != expected->length)
+        {
+            printf ("%s: short returned %d, length %lu of %lu\n", variant,
+                    ret, (unsigned long) output.length,
+                    (unsigned long) expected->length);
+            failed = 1;
+        }
+    }
+    free (output.astring);
+
+    return failed;
+}
+
+/**
+ * @brief Replaces a copy of the whole text with multifast_replace_inplace()
+ *
+ * @param trie
+ * @param c the case
+ * @param expected the expected output of the lazy mode
+ * @param variant the name of the variant, for the error message
+ * @return 0 on success, 1 otherwise
+ *****************************************************************************/
+static int oracle_inplace (AC_TRIE_t *trie, struct oracle_case *c,
+        struct oracle_output *expected, const char *variant)
+{
+    struct oracle_output got;
+    AC_TEXT_t text;
+    char *copy;
+    int ret, failed = 0;
+
+    /* Of the exact size; the sanitizers catch an overflow */
+    copy = (char *) malloc (c->length ? c->length : 1);
+    memcpy (copy, c->text, c->length);
+    text.astring = copy;
+    text.length = c->length;
+
+    ret = multifast_replace_inplace (trie, &text);
+
+    if (trie->repdata.expands)
+    {
+        if (ret != -3)
+        {
+            printf ("%s: returned %d for an expanding set\n", variant, ret);
+            failed = 1;
+        }
+    }
+    else if (ret != 0)
+    {
+        printf ("%s: returned %d\n", variant, ret);
+        failed = 1;
+    }
+    else
+    {
+        got.astring = copy;
+        got.length = text.length;
+        failed |= oracle_check_output (expected, &got, variant);
+    }
+
+    free (copy);
+
+    return failed;
+}
+
+/**
+ * @brief Collects the matches
+ *****************************************************************************/
+static int oracle_match_handler (AC_MATCH_t *m, void *param)
+{
+    struct oracle_matches *matches = (struct oracle_matches *) param;
+    size_t i;
+
+    for (i = 0; i < m->size; i++)
+        oracle_add (matches, m->position, m->patterns[i].id.u.number);
+
+    return 0;
+}
+
+/**
+ * @brief Collects the output of the replacement
+ *****************************************************************************/
+static void oracle_replace_listener (AC_TEXT_t *text, void *user)
+{
+    oracle_append ((struct oracle_output *) user, text->astring,
+            text->length);
+}
+
+/**
+ * @brief Collects the output of the replacement, segment by segment
+ *****************************************************************************/
+static void oracle_segments_listener (const AC_TEXT_t *segments,
+        size_t count, void *user)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        oracle_append ((struct oracle_output *) user, segments[i].astring,
+                segments[i].length);
+}